@@ -0,0 +1,64 @@
+/* =============================================================================
+   Arduino.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Minimal host stand-in for the Arduino core, just enough to build the
+// firmware sources on a workstation. Time is virtual: delay() advances the
+// clock instantly so simulations run at full speed.
+
+#ifndef __COMFOAIR_NATIVE_ARDUINO_H
+#define __COMFOAIR_NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define LED_BUILTIN 13
+
+#define DEC 10
+#define HEX 16
+
+// Flash memory helpers: everything lives in RAM on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcmp_P memcmp
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+// Timing
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Digital I/O (no-ops)
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+#include "WString.h"
+#include "Print.h"
+#include "HardwareSerial.h"
+
+#endif
@@ -0,0 +1,37 @@
+/* =============================================================================
+   EEPROM.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Host stand-in for the EEPROM library: 4 KB (as on the Mega 2560), erased
+// to 0xFF at start. The simulation can load and save the image to carry it
+// over to the next run, like a board that is switched off and on again.
+
+#ifndef __COMFOAIR_NATIVE_EEPROM_H
+#define __COMFOAIR_NATIVE_EEPROM_H
+
+#include <Arduino.h>
+
+#define E2END 0xFFF                             // Last EEPROM address
+
+class EEPROMClass {
+    public:
+        EEPROMClass()                           { memset(_cells, 0xFF, sizeof(_cells)); }
+
+        uint8_t read(int address)               { return _cells[address]; }
+        void write(int address, uint8_t value)  { _cells[address] = value; writes++; }
+        void update(int address, uint8_t value) { if (_cells[address] != value) write(address, value); }
+        uint16_t length()                       { return E2END + 1; }
+
+        bool load(const char* path);            // FALSE if there is no image yet
+        bool save(const char* path);
+
+        unsigned long writes;                   // Cells written (update() skips unchanged ones)
+
+    private:
+        uint8_t _cells[E2END + 1];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,124 @@
+/* =============================================================================
+   Ethernet.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Host stand-in for the Ethernet library. The network is always reachable;
+// client sockets are not backed by anything real. Server sockets are fed by
+// the simulation through ethernetConnect().
+
+#ifndef __COMFOAIR_NATIVE_ETHERNET_H
+#define __COMFOAIR_NATIVE_ETHERNET_H
+
+#include <Arduino.h>
+#include <deque>
+#include <string>
+
+class IPAddress {
+    public:
+        IPAddress()                                 { memset(_a, 0, 4); }
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { _a[0] = a; _a[1] = b; _a[2] = c; _a[3] = d; }
+        IPAddress(const uint8_t* a)                 { memcpy(_a, a, 4); }
+        uint8_t operator[](int index) const         { return _a[index]; }
+        uint8_t& operator[](int index)              { return _a[index]; }
+        bool operator==(const IPAddress& rhs) const { return memcmp(_a, rhs._a, 4) == 0; }
+        bool operator!=(const IPAddress& rhs) const { return !(*this == rhs); }
+        const uint8_t* raw() const                  { return _a; }
+    private:
+        uint8_t _a[4];
+};
+
+class Client : public Stream {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port) = 0;
+        virtual int connect(const char* host, uint16_t port) = 0;
+        virtual uint8_t connected() = 0;
+        virtual void stop() = 0;
+        virtual operator bool() = 0;
+};
+
+// Host end of a TCP connection to one of the firmware's servers (see
+// ethernetConnect())
+struct EthernetSocket {
+    uint16_t port;
+    std::deque<uint8_t> received;               // Sent by the host, not read by the firmware yet
+    std::string sent;                           // Written by the firmware
+    bool closed;                                // Firmware called stop()
+    size_t window;                              // Most bytes taken per write() (0: no limit)
+};
+
+// Opens a connection to the server on "port"; the socket stays owned by
+// the stub. With a "window", write() takes only part of a larger buffer,
+// as a Client may.
+EthernetSocket* ethernetConnect(uint16_t port, const char* request, size_t window = 0);
+
+// A default client (MQTT) is always connected and discards what it is given;
+// clients handed out by EthernetServer talk to an EthernetSocket
+class EthernetClient : public Client {
+    public:
+        EthernetClient() : _socket(NULL), _valid(true) {}
+        explicit EthernetClient(EthernetSocket* socket) : _socket(socket), _valid(socket != NULL) {}
+
+        int connect(IPAddress ip, uint16_t port) override       { (void)ip; (void)port; return 1; }
+        int connect(const char* host, uint16_t port) override   { (void)host; (void)port; return 1; }
+        uint8_t connected() override                { return _socket ? !_socket->closed : _valid; }
+        void stop() override                        { if (_socket) _socket->closed = true; }
+        operator bool() override                    { return _valid; }
+        int available() override                    { return _socket ? (int)_socket->received.size() : 0; }
+        int read() override {
+            if (!_socket || _socket->received.empty()) return -1;
+            uint8_t c = _socket->received.front();
+            _socket->received.pop_front();
+            return c;
+        }
+        int peek() override                         { return (_socket && !_socket->received.empty()) ? _socket->received.front() : -1; }
+        size_t write(uint8_t c) override            { return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size) override {
+            if (_socket) {
+                if (_socket->closed) return 0;
+                if (_socket->window && size > _socket->window) size = _socket->window;
+                _socket->sent.append((const char*)buffer, size);
+            }
+            return size;
+        }
+        using Print::write;
+
+    private:
+        EthernetSocket* _socket;
+        bool _valid;
+};
+
+class EthernetServer {
+    public:
+        EthernetServer(uint16_t port) : _port(port), _listening(false) {}
+        void begin();
+        EthernetClient available();                 // A connection with data waiting, if any
+
+    private:
+        uint16_t _port;
+        bool _listening;
+};
+
+class EthernetClass {
+    public:
+        int begin(uint8_t* mac)                     { (void)mac; _ip = IPAddress(127, 0, 0, 1); begins++; return 1; }
+        void begin(uint8_t* mac, IPAddress ip, IPAddress dns, IPAddress gw, IPAddress subnet);
+        int maintain()                              { return 0; }
+        void setLocalIP(IPAddress ip)               { _ip = ip; }
+        void setSubnetMask(IPAddress subnet)        { _subnet = subnet; }
+        void setGatewayIP(IPAddress gw)             { _gw = gw; }
+        void setDnsServerIP(IPAddress dns)          { _dns = dns; }
+        IPAddress localIP()                         { return _ip; }
+        IPAddress gatewayIP()                       { return _gw; }
+        IPAddress subnetMask()                      { return _subnet; }
+        IPAddress dnsServerIP()                     { return _dns; }
+        unsigned long begins;                       // begin() calls (only the first initialises the chip)
+        unsigned long listens;                      // EthernetServer::begin() calls (each takes a socket)
+        EthernetClass() : begins(0), listens(0) {}
+    private:
+        IPAddress _ip, _gw, _subnet, _dns;
+};
+
+extern EthernetClass Ethernet;
+
+#endif
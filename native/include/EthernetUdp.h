@@ -0,0 +1,47 @@
+/* =============================================================================
+   EthernetUdp.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Host stand-in for the Ethernet library's UDP socket. Datagrams go to the
+// simulated network (FakeNetwork in sim.h), which answers DHCP.
+
+#ifndef __COMFOAIR_NATIVE_ETHERNETUDP_H
+#define __COMFOAIR_NATIVE_ETHERNETUDP_H
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <deque>
+#include <vector>
+
+class EthernetUDP : public Stream {
+    public:
+        EthernetUDP() : _port(0), _pos(0) {}
+
+        uint8_t begin(uint16_t port)                { _port = port; return 1; }
+        void stop()                                 { _port = 0; }
+
+        int beginPacket(IPAddress ip, uint16_t port);
+        int endPacket();
+        size_t write(uint8_t c) override            { _out.push_back(c); return 1; }
+        size_t write(const uint8_t* buffer, size_t size) override { _out.insert(_out.end(), buffer, buffer + size); return size; }
+
+        int parsePacket();
+        int available() override                    { return (int)(_in.size() - _pos); }
+        int read() override                         { return (_pos < _in.size()) ? _in[_pos++] : -1; }
+        int read(uint8_t* buffer, size_t length);
+        int peek() override                         { return (_pos < _in.size()) ? _in[_pos] : -1; }
+        void flush()                                { _pos = _in.size(); }
+        IPAddress remoteIP()                        { return _remote; }
+
+    private:
+        uint16_t _port;
+        IPAddress _destination;
+        uint16_t _destinationPort;
+        IPAddress _remote;
+        std::vector<uint8_t> _out;              // Datagram being written
+        std::vector<uint8_t> _in;               // Datagram being read
+        size_t _pos;
+};
+
+#endif
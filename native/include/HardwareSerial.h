@@ -0,0 +1,56 @@
+/* =============================================================================
+   HardwareSerial.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Simulated UART. Received bytes are queued by the simulation with inject(),
+// or handed to an attached receive "interrupt" one by one; transmitted bytes
+// are kept in a TX log (or echoed to stdout for the debug port) so tests can
+// inspect them.
+
+#ifndef __COMFOAIR_NATIVE_HARDWARESERIAL_H
+#define __COMFOAIR_NATIVE_HARDWARESERIAL_H
+
+#include <deque>
+#include <vector>
+
+#define SERIAL_8N1 0x06
+#define SERIAL_RX_BUFFER_SIZE 64
+
+class HardwareSerial : public Stream {
+    public:
+        HardwareSerial(bool console = false) : _console(console), _echo(console), _overflows(0), _rxInterrupt(NULL) {}
+
+        void begin(unsigned long baud, uint8_t config = SERIAL_8N1) { (void)baud; (void)config; }
+        void end() {}
+        int available() override                    { return (int)_rx.size(); }
+        int peek() override                         { return _rx.empty() ? -1 : _rx.front(); }
+        int read() override;
+        int availableForWrite() override            { return SERIAL_RX_BUFFER_SIZE; }
+        void flush() {}
+        size_t write(uint8_t c) override;
+        using Print::write;
+        operator bool() const                       { return true; }
+
+        // Simulation hooks
+        size_t inject(const uint8_t* data, size_t length, bool limit = true);
+        void attachRxInterrupt(void (*isr)(uint8_t)) { _rxInterrupt = isr; }
+        std::vector<uint8_t>& txLog()               { return _tx; }
+        void setEcho(bool echo)                     { _echo = echo; }
+        unsigned long overflows() const             { return _overflows; }
+
+    private:
+        bool _console;
+        bool _echo;
+        unsigned long _overflows;
+        void (*_rxInterrupt)(uint8_t);          // Replaces the RX queue when set
+        std::deque<uint8_t> _rx;
+        std::vector<uint8_t> _tx;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+#endif
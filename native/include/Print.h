@@ -0,0 +1,43 @@
+/* =============================================================================
+   Print.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_NATIVE_PRINT_H
+#define __COMFOAIR_NATIVE_PRINT_H
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        size_t write(const char* str)               { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+        size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+        virtual int availableForWrite()             { return 0; }
+
+        size_t print(const __FlashStringHelper* s)  { return write(reinterpret_cast<const char*>(s)); }
+        size_t print(const String& s)               { return write(s.c_str()); }
+        size_t print(const char* s)                 { return write(s); }
+        size_t print(char c)                        { return write((uint8_t)c); }
+        size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+        size_t print(int n, int base = DEC)         { return print((long)n, base); }
+        size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+        size_t print(long n, int base = DEC);
+        size_t print(unsigned long n, int base = DEC);
+        size_t print(double n, int digits = 2);
+
+        size_t println()                            { return write("\r\n"); }
+        template <typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+        template <typename T> size_t println(const T& v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        size_t readBytes(uint8_t* buffer, size_t length);
+        size_t readBytes(char* buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+};
+
+#endif
@@ -0,0 +1,46 @@
+/* =============================================================================
+   PubSubClient.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Host stand-in for PubSubClient. Everything that is published ends up in the
+// FakeBroker (see sim.h) so the simulation can inspect it afterwards.
+
+#ifndef __COMFOAIR_NATIVE_PUBSUBCLIENT_H
+#define __COMFOAIR_NATIVE_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 128
+#endif
+
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+
+class PubSubClient {
+    public:
+        PubSubClient(Client& client) : _client(client), _connected(false), _callback(NULL) {}
+
+        PubSubClient& setServer(const char* domain, uint16_t port)  { (void)domain; (void)port; return *this; }
+        PubSubClient& setServer(IPAddress ip, uint16_t port)         { (void)ip; (void)port; return *this; }
+        PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE)           { _callback = callback; return *this; }
+        PubSubClient& setSocketTimeout(uint16_t timeout)             { (void)timeout; return *this; }
+
+        boolean connect(const char* id);
+        void disconnect()                           { _connected = false; }
+        boolean connected();
+        boolean loop();
+        boolean publish(const char* topic, const char* payload);
+        boolean publish(const char* topic, const char* payload, boolean retained);
+        boolean publish(const char* topic, const uint8_t* payload, unsigned int plength);
+        boolean publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained);
+        boolean subscribe(const char* topic);
+
+    private:
+        Client& _client;
+        bool _connected;
+        void (*_callback)(char*, uint8_t*, unsigned int);
+};
+
+#endif
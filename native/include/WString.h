@@ -0,0 +1,43 @@
+/* =============================================================================
+   WString.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_NATIVE_WSTRING_H
+#define __COMFOAIR_NATIVE_WSTRING_H
+
+#include <string>
+
+class String {
+    public:
+        String(const char* cstr = "") : _s(cstr ? cstr : "") {}
+        String(const std::string& s) : _s(s) {}
+        explicit String(char c) : _s(1, c) {}
+        explicit String(unsigned char value, unsigned char base = 10);
+        explicit String(int value, unsigned char base = 10);
+        explicit String(unsigned int value, unsigned char base = 10);
+        explicit String(long value, unsigned char base = 10);
+        explicit String(unsigned long value, unsigned char base = 10);
+        explicit String(float value, unsigned char decimalPlaces = 2);
+        explicit String(double value, unsigned char decimalPlaces = 2);
+
+        unsigned int length() const                 { return _s.length(); }
+        const char* c_str() const                   { return _s.c_str(); }
+        void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const;
+
+        String& operator+=(const String& rhs)       { _s += rhs._s; return *this; }
+        String& operator+=(const char* rhs)         { _s += rhs; return *this; }
+        String& operator+=(char c)                  { _s += c; return *this; }
+        bool operator==(const String& rhs) const    { return _s == rhs._s; }
+        bool operator==(const char* rhs) const      { return _s == rhs; }
+        char operator[](unsigned int index) const   { return _s[index]; }
+
+        friend String operator+(const String& lhs, const String& rhs) { return String(lhs._s + rhs._s); }
+        friend String operator+(const String& lhs, const char* rhs)   { return String(lhs._s + rhs); }
+        friend String operator+(const char* lhs, const String& rhs)   { return String(lhs + rhs._s); }
+
+    private:
+        std::string _s;
+};
+
+#endif
@@ -0,0 +1,244 @@
+/* =============================================================================
+   Arduino.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <EEPROM.h>
+#include <chrono>
+#include <vector>
+
+/*=============================================================================
+   TIMING
+  ============================================================================= */
+
+static std::chrono::steady_clock::time_point __bootTime = std::chrono::steady_clock::now();
+static unsigned long long __virtualMicros = 0;            // Time added by delay()
+
+unsigned long micros() {
+    unsigned long long real = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - __bootTime).count();
+    return (unsigned long)(real + __virtualMicros);
+}
+
+unsigned long millis() {
+    return micros() / 1000UL;
+}
+
+void delay(unsigned long ms) {
+    __virtualMicros += (unsigned long long)ms * 1000ULL;
+}
+
+void delayMicroseconds(unsigned int us) {
+    __virtualMicros += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+void digitalWrite(uint8_t pin, uint8_t val) { (void)pin; (void)val; }
+
+/*=============================================================================
+   STRING
+  ============================================================================= */
+
+static std::string __numberToString(unsigned long value, unsigned char base, bool negative) {
+    char buf[8 * sizeof(long) + 2];
+    char* p = buf + sizeof(buf) - 1;
+    *p = 0;
+    if (base < 2) base = 10;
+    do {
+        unsigned long digit = value % base;
+        *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value > 0);
+    if (negative) *--p = '-';
+    return std::string(p);
+}
+
+String::String(unsigned char value, unsigned char base) : _s(__numberToString(value, base, false)) {}
+String::String(int value, unsigned char base) : String((long)value, base) {}
+String::String(unsigned int value, unsigned char base) : _s(__numberToString(value, base, false)) {}
+String::String(long value, unsigned char base)
+    : _s((base == 10 && value < 0) ? __numberToString((unsigned long)(-value), base, true)
+                                   : __numberToString((unsigned long)value, base, false)) {}
+String::String(unsigned long value, unsigned char base) : _s(__numberToString(value, base, false)) {}
+String::String(float value, unsigned char decimalPlaces) : String((double)value, decimalPlaces) {}
+String::String(double value, unsigned char decimalPlaces) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    _s = buf;
+}
+
+void String::toCharArray(char* buf, unsigned int bufsize, unsigned int index) const {
+    if (!bufsize || !buf) return;
+    if (index >= _s.length()) { buf[0] = 0; return; }
+    unsigned int n = _s.length() - index;
+    if (n > bufsize - 1) n = bufsize - 1;
+    memcpy(buf, _s.c_str() + index, n);
+    buf[n] = 0;
+}
+
+/*=============================================================================
+   PRINT / STREAM
+  ============================================================================= */
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(long n, int base) {
+    if (base == 10 && n < 0) {
+        return write(__numberToString((unsigned long)(-n), 10, true).c_str());
+    }
+    return write(__numberToString((unsigned long)n, (unsigned char)base, false).c_str());
+}
+
+size_t Print::print(unsigned long n, int base) {
+    std::string s = __numberToString(n, (unsigned char)base, false);
+    if (base == HEX) {
+        for (size_t i = 0; i < s.length(); i++) {
+            if (s[i] >= 'a') s[i] -= 0x20;
+        }
+    }
+    return write(s.c_str());
+}
+
+size_t Print::print(double n, int digits) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+size_t Stream::readBytes(uint8_t* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int c = read();
+        if (c < 0) break;
+        *buffer++ = (uint8_t)c;
+        count++;
+    }
+    return count;
+}
+
+/*=============================================================================
+   HARDWARE SERIAL
+  ============================================================================= */
+
+HardwareSerial Serial(true);
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+HardwareSerial Serial3;
+
+EthernetClass Ethernet;
+
+/*=============================================================================
+   SERVER SOCKETS
+  ============================================================================= */
+
+static std::vector<EthernetSocket*> ethernetSockets;
+
+EthernetSocket* ethernetConnect(uint16_t port, const char* request, size_t window) {
+    EthernetSocket* socket = new EthernetSocket();
+    socket->port = port;
+    socket->window = window;
+    socket->received.assign(request, request + strlen(request));
+    socket->closed = false;
+    ethernetSockets.push_back(socket);
+    return socket;
+}
+
+// As in the Ethernet library (2.x), W5100.init() resets the chip on the
+// first call only and returns early after that: a later begin() just sets
+// the addresses, and open sockets stay open
+void EthernetClass::begin(uint8_t* mac, IPAddress ip, IPAddress dns, IPAddress gw, IPAddress subnet) {
+    (void)mac;
+    _ip = ip;
+    _dns = dns;
+    _gw = gw;
+    _subnet = subnet;
+    begins++;
+}
+
+// Every call takes a socket of its own, as in the library
+void EthernetServer::begin() {
+    _listening = true;
+    Ethernet.listens++;
+}
+
+EthernetClient EthernetServer::available() {
+    if (_listening) {
+        for (size_t i = 0; i < ethernetSockets.size(); i++) {
+            EthernetSocket* socket = ethernetSockets[i];
+            if (socket->port == _port && !socket->closed && !socket->received.empty()) {
+                return EthernetClient(socket);
+            }
+        }
+    }
+    return EthernetClient(NULL);
+}
+
+int HardwareSerial::read() {
+    if (_rx.empty()) return -1;
+    uint8_t c = _rx.front();
+    _rx.pop_front();
+    return c;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (_console) {
+        if (_echo) fputc(c, stdout);
+    } else {
+        _tx.push_back(c);
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// INJECT
+// ---------------------------------------------------------------------------
+// Simulates bytes arriving on the RX line. With "limit" set, the core's
+// SERIAL_RX_BUFFER_SIZE is honoured and bytes that do not fit are lost, just
+// like on the board.
+// ---------------------------------------------------------------------------
+
+size_t HardwareSerial::inject(const uint8_t* data, size_t length, bool limit) {
+    size_t stored = 0;
+    if (_rxInterrupt) {
+        for (size_t i = 0; i < length; i++) _rxInterrupt(data[i]);
+        return length;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (limit && (_rx.size() >= SERIAL_RX_BUFFER_SIZE - 1)) {
+            _overflows++;
+            continue;
+        }
+        _rx.push_back(data[i]);
+        stored++;
+    }
+    return stored;
+}
+
+/*=============================================================================
+   EEPROM
+  ============================================================================= */
+
+EEPROMClass EEPROM;
+
+bool EEPROMClass::load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    size_t n = fread(_cells, 1, sizeof(_cells), file);
+    fclose(file);
+    return n == sizeof(_cells);
+}
+
+bool EEPROMClass::save(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    size_t n = fwrite(_cells, 1, sizeof(_cells), file);
+    return (fclose(file) == 0) && (n == sizeof(_cells));
+}
@@ -0,0 +1,249 @@
+/* =============================================================================
+   Bench.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "bench.h"
+#include "sim.h"
+#include "replay.h"
+#include "../../src/mqtt.h"
+#include "../../src/zehnder.h"
+#include "../../src/decoder.h"
+#include "../../src/uart.h"
+#include <chrono>
+
+extern ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double elapsedMicros(BenchClock::time_point start, BenchClock::time_point stop) {
+    return std::chrono::duration<double, std::micro>(stop - start).count();
+}
+
+/*=============================================================================
+   TRAFFIC GENERATOR
+  ============================================================================= */
+
+const char* TrafficGenerator::name(uint8_t profile) {
+    switch (profile) {
+        case TRAFFIC_REALISTIC: return "realistic";
+        case TRAFFIC_STUFFED:   return "stuffed";
+        case TRAFFIC_NOISE:     return "noise";
+        case TRAFFIC_PARTIAL:   return "partial";
+        case TRAFFIC_MAXLENGTH: return "maxlength";
+    }
+    return "?";
+}
+
+uint8_t TrafficGenerator::random8() {
+    _seed = _seed * 1103515245UL + 12345UL;
+    return (uint8_t)(_seed >> 16);
+}
+
+void TrafficGenerator::frame(std::vector<uint8_t>& out, uint8_t cmd, const uint8_t* data, uint8_t length, bool ack) {
+    uint8_t buf[CADEC_FRAMESIZE];
+    size_t n = caEncodeFrame(cmd, data, length, buf);
+    out.insert(out.end(), buf, buf + n);
+    if (ack) {
+        out.push_back(0x07);
+        out.push_back(0xF3);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// GENERATE
+// ---------------------------------------------------------------------------
+// Appends at least "minBytes" of traffic of the given profile to "out".
+//
+// OUTPUTS:
+//    unsigned long  Number of valid frames contained in the generated data
+// ---------------------------------------------------------------------------
+
+unsigned long TrafficGenerator::generate(uint8_t profile, size_t minBytes, std::vector<uint8_t>& out) {
+    // Typical panel/unit exchanges: request command and reply data length
+    static const uint8_t exchanges[][2] = {
+        { 0xD1, 9 }, { 0x0B, 6 }, { 0x0D, 4 }, { 0xCD, 14 }, { 0x11, 5 }, { 0xDD, 20 }, { 0xD9, 17 }
+    };
+    const uint8_t maxData = (uint8_t)(CACMD_MAXLENGTH - CACMD_MINLENGTH);
+    uint8_t data[256];
+    unsigned long frames = 0;
+    size_t target = out.size() + minBytes;
+    size_t turn = 0;
+
+    while (out.size() < target) {
+        const uint8_t* ex = exchanges[turn++ % (sizeof(exchanges) / sizeof(exchanges[0]))];
+        uint8_t length = ex[1];
+        switch (profile) {
+            case TRAFFIC_STUFFED:
+                for (uint8_t i = 0; i < length; i++) data[i] = (random8() & 1) ? 0x07 : random8();
+                break;
+            case TRAFFIC_MAXLENGTH:
+                length = maxData;
+                for (uint16_t i = 0; i < length; i++) data[i] = random8();
+                break;
+            default:
+                for (uint8_t i = 0; i < length; i++) data[i] = 40 + (random8() & 0x3F);
+                break;
+        }
+
+        if (profile == TRAFFIC_NOISE) {
+            // Garbage that does not contain 0x07, so it cannot swallow a frame
+            uint8_t count = random8() & 0x1F;
+            for (uint8_t i = 0; i < count; i++) {
+                uint8_t c = random8();
+                out.push_back(c == 0x07 ? 0x06 : c);
+            }
+        } else if (profile == TRAFFIC_PARTIAL) {
+            // Start of a frame that never completes, then a stray 0x07
+            out.push_back(0x07); out.push_back(0xF0); out.push_back(0x00);
+            out.push_back(0x07);
+            out.push_back(0x07);
+        }
+
+        frame(out, ex[0], NULL, 0, true);
+        frame(out, ex[0] + 1, data, length, true);
+        frames += 2;
+    }
+    return frames;
+}
+
+/*=============================================================================
+   BENCHMARK
+  ============================================================================= */
+
+struct BenchResult {
+    unsigned long bytes;
+    unsigned long frames;
+    unsigned long calls;
+    double totalMicros;
+    double worstMicros;
+};
+
+// Raw decoder speed: no serial port, no processing
+static BenchResult benchDecoder(const std::vector<uint8_t>& stream) {
+    ComfoAirDecoder decoder;
+    BenchResult r = { (unsigned long)stream.size(), 0, 1, 0, 0 };
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t i = 0; i < stream.size(); i++) {
+        if (decoder.push(stream[i]) == CADEC_FRAME) r.frames++;
+    }
+    r.totalMicros = r.worstMicros = elapsedMicros(start, BenchClock::now());
+    return r;
+}
+
+// Full path: serial port -> checkCommand() -> processCommand() -> MQTT
+static BenchResult benchCheckCommand(const std::vector<uint8_t>& stream, size_t chunk) {
+    BenchResult r = { (unsigned long)stream.size(), 0, 0, 0, 0 };
+    unsigned long framesBefore = zehnderDecoders[0].stats().frames;
+    for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+        size_t n = (pos + chunk <= stream.size()) ? chunk : stream.size() - pos;
+        ZEHNDER_PORT.inject(&stream[pos], n, false);
+        BenchClock::time_point start = BenchClock::now();
+        checkCommand();
+        double t = elapsedMicros(start, BenchClock::now());
+        r.totalMicros += t;
+        if (t > r.worstMicros) r.worstMicros = t;
+        r.calls++;
+    }
+    r.frames = zehnderDecoders[0].stats().frames - framesBefore;
+    fakeBroker.messages.clear();
+    return r;
+}
+
+static void printResult(bool csv, const char* profile, const char* mode, size_t chunk,
+                        unsigned long expected, const BenchResult& r) {
+    double seconds = r.totalMicros / 1e6;
+    double bps = seconds > 0 ? r.bytes / seconds : 0;
+    double fps = seconds > 0 ? r.frames / seconds : 0;
+    if (csv) {
+        printf("%s,%s,%lu,%lu,%lu,%lu,%.0f,%.0f,%.3f,%.3f\n", profile, mode, (unsigned long)chunk,
+               r.bytes, r.frames, expected - r.frames, bps, fps, r.totalMicros / r.calls, r.worstMicros);
+    } else {
+        printf("%-10s %-8s %6lu %10lu %8lu %5lu %12.0f %10.0f %10.3f %10.3f\n", profile, mode,
+               (unsigned long)chunk, r.bytes, r.frames, expected - r.frames, bps, fps,
+               r.totalMicros / r.calls, r.worstMicros);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// RUNBENCHMARK
+// ---------------------------------------------------------------------------
+// Usage: program --bench [--bytes N] [--chunk N] [--replay FILE] [--csv]
+//
+//    --bytes N      Stream size per traffic profile (default 1000000)
+//    --chunk N      Only test this read size (default: 1, 8, 64 and 256;
+//                   at most ZEHNDER_RXBUFFER)
+//    --replay FILE  Also run a recorded bus capture (see src/capture.h) as
+//                   profile "capture"; its expected frame count is what
+//                   the bare decoder finds
+//    --csv          Machine readable output, for comparing against a baseline
+// ---------------------------------------------------------------------------
+
+int runBenchmark(int argc, char** argv) {
+    size_t bytes = 1000000;
+    size_t onlyChunk = 0;
+    bool csv = false;
+    const char* replayFile = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bytes") && i + 1 < argc) bytes = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--chunk") && i + 1 < argc) onlyChunk = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc) replayFile = argv[++i];
+        else if (!strcmp(argv[i], "--csv")) csv = true;
+    }
+    const size_t chunks[] = { 1, 8, 64, 256 };
+    if (onlyChunk > ZEHNDER_RXBUFFER) {
+        onlyChunk = ZEHNDER_RXBUFFER;           // Larger reads would overflow the capture buffer
+    }
+
+    // Firmware output would dominate the measurement
+    Serial.setEcho(false);
+    zehnderInit();
+    mqttInit();
+    mqttReconnect();
+
+    if (csv) {
+        printf("profile,mode,chunk,bytes,frames,lost,bytes_per_s,frames_per_s,avg_us_per_call,worst_us_per_call\n");
+    } else {
+        printf("%-10s %-8s %6s %10s %8s %5s %12s %10s %10s %10s\n", "profile", "mode", "chunk", "bytes",
+               "frames", "lost", "bytes/s", "frames/s", "avg us", "worst us");
+    }
+
+    std::vector<uint8_t> capture;
+    if (replayFile) {
+        std::vector<CaptureRecord> records;
+        CaptureInfo info;
+        if (!readCapture(replayFile, records, info)) {
+            fprintf(stderr, "Cannot read capture %s\n", replayFile);
+            return 2;
+        }
+        for (size_t i = 0; i < records.size(); i++) {
+            capture.insert(capture.end(), records[i].bytes.begin(), records[i].bytes.end());
+        }
+    }
+
+    for (uint8_t profile = 0; profile < TRAFFIC_PROFILES + (replayFile ? 1 : 0); profile++) {
+        std::vector<uint8_t> stream;
+        unsigned long expected;
+        const char* name;
+        BenchResult reference;
+        if (profile < TRAFFIC_PROFILES) {
+            TrafficGenerator generator;
+            expected = generator.generate(profile, bytes, stream);
+            name = TrafficGenerator::name(profile);
+            reference = benchDecoder(stream);
+        } else {
+            stream = capture;
+            name = "capture";
+            reference = benchDecoder(stream);
+            expected = reference.frames;
+        }
+
+        printResult(csv, name, "decoder", stream.size(), expected, reference);
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            size_t chunk = onlyChunk ? onlyChunk : chunks[c];
+            printResult(csv, name, "check", chunk, expected, benchCheckCommand(stream, chunk));
+            if (onlyChunk) break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+/* =============================================================================
+   Bench.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Parser throughput/latency benchmark with a synthetic ComfoAir traffic
+// generator.
+
+#ifndef __COMFOAIR_NATIVE_BENCH_H
+#define __COMFOAIR_NATIVE_BENCH_H
+
+#include <Arduino.h>
+#include <vector>
+
+/* --------------------------------------------------------------------------
+   Traffic generator
+   --------------------------------------------------------------------------
+   Builds byte streams out of valid frames (see caEncodeFrame) mixed
+   with the things that make a parser's life hard.
+   -------------------------------------------------------------------------- */
+
+enum TrafficProfile : uint8_t {
+    TRAFFIC_REALISTIC = 0,                      // Panel requests + unit replies with ACKs
+    TRAFFIC_STUFFED,                            // Payloads full of 0x07 (byte stuffing)
+    TRAFFIC_NOISE,                              // Random garbage between frames
+    TRAFFIC_PARTIAL,                            // Aborted start sequences and stray 0x07s
+    TRAFFIC_MAXLENGTH,                          // 255-byte payloads (CACMD_MAXLENGTH frames)
+    TRAFFIC_PROFILES
+};
+
+class TrafficGenerator {
+    public:
+        TrafficGenerator(uint32_t seed = 12345) : _seed(seed) {}
+
+        static const char* name(uint8_t profile);
+        unsigned long generate(uint8_t profile, size_t minBytes, std::vector<uint8_t>& out);
+
+    private:
+        uint32_t _seed;
+        uint8_t random8();
+        void frame(std::vector<uint8_t>& out, uint8_t cmd, const uint8_t* data, uint8_t length, bool ack);
+};
+
+int runBenchmark(int argc, char** argv);
+
+#endif
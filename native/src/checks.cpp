@@ -0,0 +1,255 @@
+/* =============================================================================
+   Checks.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "checks.h"
+#include <Arduino.h>
+#include "../../src/commands.h"
+#include "../../src/control.h"
+#include "../../src/zehnder.h"
+#include "../../src/bus.h"
+#include "../../src/queue.h"
+#include "../../src/publish.h"
+#include "../../src/mqtt.h"
+#include "../../src/scheduler.h"
+#include <string>
+
+extern MessageQueue mqttQueue;
+
+static unsigned long checksRun = 0;
+static unsigned long checksFailed = 0;
+
+// Counts a check and prints it when it fails
+static void check(bool passed, const char* what) {
+    checksRun++;
+    if (!passed) {
+        checksFailed++;
+        printf("FAILED: %s\n", what);
+    }
+}
+
+/*=============================================================================
+   FIELD TABLE
+  ============================================================================= */
+
+// caFindCommand() does a binary search: the rows must be sorted on command,
+// and every field must lie within a ComfoAir data block
+static void checkFieldTable() {
+    CAField previous = CAField();
+    CAField field;
+    for (uint8_t i = 0; i < CAFIELD_COUNT; i++) {
+        caReadField(i, field);
+        char what[64];
+        snprintf(what, sizeof(what), "caFields[%u] sorted on command", i);
+        check(i == 0 || field.command >= previous.command, what);
+        snprintf(what, sizeof(what), "caFields[%u] width 1..4", i);
+        check(field.width >= 1 && field.width <= 4, what);
+        snprintf(what, sizeof(what), "caFields[%u] found by caFindCommand()", i);
+        uint8_t first = caFindCommand(field.command);
+        check(first != CAFIELD_NONE && first <= i, what);
+        previous = field;
+    }
+}
+
+/*=============================================================================
+   SETTINGS OVER MQTT
+  ============================================================================= */
+
+// Hands "message" to the control module as if it came in over MQTT; TRUE
+// if the setting was accepted
+static bool controlAccepts(const char* message) {
+    ControlStats before = controlStats(0);
+    controlMessage(0, (const byte*)message, strlen(message));
+    const ControlStats& after = controlStats(0);
+    return after.received == before.received + 1 && after.rejected == before.rejected;
+}
+
+static void checkControl() {
+    // Value, and whether it must be accepted (fan: 0..4, comfort: 12.0..28.0)
+    const struct {
+        const char* message;
+        bool accepted;
+    } cases[] = {
+        { "fan=3", true },
+        { "fan=0", true },
+        { "comfort=21.5", true },
+        { "comfort=12", true },
+        { "comfort=28.0", true },
+        { "fan=5", false },                     // Above the maximum
+        { "fan=-1", false },                    // Below the minimum
+        { "fan=3.5", false },                   // Not a whole number
+        { "fan=32768", false },                 // Would wrap to 0 as int16_t
+        { "fan=99999", false },
+        { "fan=123456", false },                // Too many digits
+        { "comfort=6566", false },              // Would wrap to 12.4 as int16_t
+        { "comfort=28.1", false },
+        { "comfort=21.55", false },             // Two decimals
+        { "comfort=.", false },                 // No digits
+        { "fan=.", false },
+        { "fan=-", false },
+        { "fan=-.", false },
+        { "fan=", false },
+        { "fan=3x", false },
+        { "speed=3", false },                   // Unknown key
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char what[64];
+        snprintf(what, sizeof(what), "\"%s\" %s", cases[i].message, cases[i].accepted ? "accepted" : "rejected");
+        check(controlAccepts(cases[i].message) == cases[i].accepted, what);
+    }
+}
+
+/*=============================================================================
+   BUS CORRELATOR
+  ============================================================================= */
+
+#ifdef BUS_ENABLE
+// One request on the line of unit 0 and its reply 10 ms later
+static void busExchange(uint8_t command) {
+    busFrame(0, command, 0);
+    busAck(0);
+    delay(10);
+    busFrame(0, command + 1, 4);
+    busAck(0);
+}
+
+// Ends the interval and runs the report; returns the lines it queued
+static std::string busReportLines() {
+    delay(BUS_INTERVAL);
+    for (uint8_t i = 0; i < 2 * (BUS_COMMANDS + 2) * ZEHNDER_UNITS; i++) busMaintain();
+    std::string lines;
+    uint8_t topic;
+    const byte* payload;
+    uint16_t length;
+    while (mqttQueue.peek(topic, payload, length)) {
+        lines.append((const char*)payload, length).append("\n");
+        mqttQueue.pop();
+    }
+    return lines;
+}
+
+static void checkBus() {
+    busReportLines();                           // Start a fresh interval
+
+    // A frame with data that answers no request is unsolicited; the reply
+    // to a request seen before, but no longer pending, is unmatched
+    BusStats before = busStats(0);
+    busFrame(0, 0x3C, 5);
+    check(busStats(0).unsolicited == before.unsolicited + 1, "bus: frame without request counted as unsolicited");
+    check(busStats(0).unmatched == before.unmatched, "bus: unsolicited frame not counted as unmatched");
+    busExchange(0x0B);
+    busFrame(0, 0x0C, 6);
+    check(busStats(0).unmatched == before.unmatched + 1, "bus: reply without pending request counted as unmatched");
+    check(busStats(0).unsolicited == before.unsolicited + 1, "bus: unmatched reply not counted as unsolicited");
+
+    // Fill every row in one interval; a new command in the next interval
+    // must get a row of its own
+    for (uint8_t i = 0; i < BUS_COMMANDS; i++) busExchange(0x41 + 2 * i);
+    std::string first = busReportLines();
+    check(first.find("request=41 ") != std::string::npos, "bus: first interval reports its commands");
+    busExchange(0x71);
+    std::string second = busReportLines();
+    check(second.find("request=71 ") != std::string::npos, "bus: rows are reset after a report");
+    check(second.find("request=41 ") == std::string::npos, "bus: old rows are not reported again");
+}
+#endif
+
+/*=============================================================================
+   RESTORED VALUES
+  ============================================================================= */
+
+// Empties the MQTT queue; returns how many of the messages were for unit
+// 0's topic "kind" (MQTT_TOPIC_FIELD: any field topic)
+static unsigned int queuedFor(uint8_t kind) {
+    unsigned int count = 0;
+    uint8_t topic;
+    const byte* payload;
+    uint16_t length;
+    while (mqttQueue.peek(topic, payload, length)) {
+        if (topic == kind || (kind == MQTT_TOPIC_FIELD && topic >= MQTT_TOPIC_FIELD && topic < MQTT_TOPIC_UNIT)) count++;
+        mqttQueue.pop();
+    }
+    return count;
+}
+
+// Ends the window and runs it out for every unit
+static void publishWindow() {
+    publishFlush();
+    for (uint8_t i = 0; i < ZEHNDER_UNITS; i++) publishMaintain();
+}
+
+// A value restored from EEPROM is the latest value, but not a sample: it
+// only goes out on the stale topic, and the first decoded value is sent
+// even when it equals the restored one
+static void checkRestore() {
+#ifdef PUBLISH_FIELDS
+    const uint8_t data = MQTT_TOPIC_FIELD;
+#else
+    const uint8_t data = MQTT_TOPIC_DATA;
+#endif
+    long value = 0;
+    queuedFor(data);
+    publishRestore(0, 0, 42);
+    check(publishLatest(0, 0, value) && value == 42, "restore: restored value is the latest value");
+    check(publishStale(0) == 1, "restore: restored value counted as stale");
+    publishWindow();
+    check(queuedFor(data) == 0, "restore: restored value not sent with the window");
+#ifndef PUBLISH_FIELDS
+    check(publishStaleUnit(0) == 1 && queuedFor(MQTT_TOPIC_STALE) == 1, "restore: restored value sent on the stale topic");
+#endif
+    publishSample(0, 0, 42);
+    check(publishStale(0) == 0, "restore: decoded value is no longer stale");
+    publishWindow();
+    check(queuedFor(data) == 1, "restore: first decoded value sent, even if equal to the restored one");
+}
+
+/*=============================================================================
+   TASK TIMING REPORT
+  ============================================================================= */
+
+static void checkTask() {}
+
+static const char checkTaskName[] PROGMEM = "a_long_task_name";
+
+// Tasks that do not fit one message go on in the next, each exactly once
+static void checkSchedReport() {
+    SchedTask tasks[6];
+    for (uint8_t i = 0; i < 6; i++) {
+        tasks[i] = SchedTask{checkTaskName, checkTask, 100, 1000, SCHED_NORMAL};
+    }
+    schedInit(tasks, 6, checkTask);
+    char buffer[80];
+    PayloadWriter msg(buffer, sizeof(buffer));
+    std::string report;
+    uint8_t task = 0;
+    unsigned int messages = 0;
+    bool done;
+    do {
+        msg.reset();
+        msg.append(F("command=04"));
+        done = schedReport(msg, task);
+        report.append(msg.c_str()).append("\n");
+        messages++;
+    } while (!done && messages < 10);
+    size_t count = 0;
+    for (size_t at = report.find(checkTaskName); at != std::string::npos; at = report.find(checkTaskName, at + 1)) count++;
+    check(done && messages > 1, "sched: report split over several messages");
+    check(count == 6, "sched: every task reported exactly once");
+    check(report.find("gap=") == report.rfind("gap="), "sched: gap only in the first message");
+}
+
+int runChecks(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    Serial.setEcho(false);                      // Rejections are logged
+    checkFieldTable();
+    checkControl();
+#ifdef BUS_ENABLE
+    checkBus();
+#endif
+    checkRestore();
+    checkSchedReport();
+    printf("%lu checks, %lu failed\n", checksRun, checksFailed);
+    return checksFailed ? 1 : 0;
+}
@@ -0,0 +1,15 @@
+/* =============================================================================
+   Checks.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Self-checks of tables, parsers and the bus report that the simulation
+// does not reach: program --check runs them all and exits non-zero if any
+// of them fails.
+
+#ifndef __COMFOAIR_NATIVE_CHECKS_H
+#define __COMFOAIR_NATIVE_CHECKS_H
+
+int runChecks(int argc, char** argv);
+
+#endif
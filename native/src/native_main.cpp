@@ -0,0 +1,408 @@
+/* =============================================================================
+   Native_main.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Entry point for the host build. Runs the unmodified firmware setup() and
+// loop() against a simulated ComfoAir unit and MQTT broker. The unit answers
+// every request of the polling plan.
+//
+// Usage:
+//    program [--frames N] [--hex FILE] [--replay FILE [--speed X]] [--outage FROM TO]
+//            [--command MSG]... [--capture FILE] [--http PATH]... [--eeprom FILE]
+//            [--nodhcp] [--lease S [--norenew]] [--reinit T] [--replygap MS] [--quiet]
+//    program --bench [--bytes N] [--chunk N] [--replay FILE] [--csv]
+//    program --check
+//
+//    --frames N     Number of generated 0xD1/0xD2 exchanges (default 20)
+//    --hex FILE     Replay a recorded hex byte stream instead of generating
+//    --replay FILE  Replay a binary bus capture (see src/capture.h) with its
+//                   original timing, sped up X times with --speed
+//    --capture FILE Save the capture chunks the firmware published
+//    --outage F T   Take the broker offline from F to T ms after traffic starts
+//    --command MSG  Send MSG (e.g. "fan=3") to MQTTSUBTOPIC when traffic starts
+//    --http PATH    Request PATH from the HTTP server at the end and print the response
+//    --eeprom FILE  Start from the EEPROM image in FILE (if it exists), write a
+//                   record at the end and save the image: a second run with
+//                   the same FILE is a warm start (see src/persist.h)
+//    --nodhcp       No DHCP server on the network: the static address is used
+//    --lease S      Lease time handed out by the DHCP server (default 3600 s)
+//    --norenew      The DHCP server ignores unicast renewals, so the firmware
+//                   has to rebind by broadcast
+//    --reinit T     Start the network bring-up over (networkInit()) T ms after
+//                   traffic starts; the open sockets have to survive it
+//    --replygap MS  The unit answers MS ms after a request (default 2); from
+//                   POLL_TIMEOUT on, its replies are too late for the poller
+//    --quiet        Suppress the firmware's DEBUGOUT output
+//
+//    Built with ZEHNDER_UNITS > 1, further units on Serial2/Serial3 run
+//    generated traffic next to the first one.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "sim.h"
+#include "bench.h"
+#include "checks.h"
+#include "replay.h"
+#include "telemetry.h"
+#include "../../src/mqtt.h"
+#include "../../src/zehnder.h"
+#include "../../src/decoder.h"
+#include "../../src/publish.h"
+#include "../../src/uart.h"
+#include "../../src/poller.h"
+#include "../../src/control.h"
+#include "../../src/bus.h"
+#include "../../src/capture.h"
+#include "../../src/network.h"
+#include "../../src/http.h"
+#include "../../src/persist.h"
+
+void setup();
+void loop();
+
+extern ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
+
+#ifdef HTTP_ENABLE
+// Requests "path" from the firmware's HTTP server and runs the firmware
+// until it closes the connection; empty if it does not within 10 s. With a
+// "window", the connection takes at most that many bytes per write.
+static std::string httpGet(const char* path, size_t window = 0) {
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: comfoair\r\n\r\n";
+    EthernetSocket* socket = ethernetConnect(HTTP_PORT, request.c_str(), window);
+    for (unsigned long end = millis() + 10000; !socket->closed && millis() < end; ) {
+        loop();
+        delay(1);
+    }
+    return socket->closed ? socket->sent : std::string();
+}
+#endif
+
+static int runSimulation(int argc, char** argv) {
+    unsigned long frames = 20;
+    const char* hexFile = NULL;
+    const char* replayFile = NULL;
+    const char* captureFile = NULL;
+    const char* eepromFile = NULL;
+    double speed = 1;
+    unsigned long outageFrom = 0, outageTo = 0;
+    unsigned long replyGap = 2;
+    unsigned long reinitAt = 0;
+    std::vector<const char*> commands;
+    std::vector<const char*> httpPaths;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) frames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--outage") && i + 2 < argc) {
+            outageFrom = strtoul(argv[++i], NULL, 10);
+            outageTo = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--hex") && i + 1 < argc) hexFile = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc) replayFile = argv[++i];
+        else if (!strcmp(argv[i], "--speed") && i + 1 < argc) speed = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--capture") && i + 1 < argc) captureFile = argv[++i];
+        else if (!strcmp(argv[i], "--command") && i + 1 < argc) commands.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--http") && i + 1 < argc) httpPaths.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--eeprom") && i + 1 < argc) eepromFile = argv[++i];
+        else if (!strcmp(argv[i], "--nodhcp")) fakeNetwork.dhcp = false;
+        else if (!strcmp(argv[i], "--lease") && i + 1 < argc) fakeNetwork.leaseTime = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--norenew")) fakeNetwork.unicast = false;
+        else if (!strcmp(argv[i], "--replygap") && i + 1 < argc) replyGap = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--reinit") && i + 1 < argc) reinitAt = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--quiet")) Serial.setEcho(false);
+    }
+
+    if (speed <= 0) speed = 1;
+    FakeUnit unit(ZEHNDER_PORT, (unsigned long)(960 * speed));
+    bool recorded = hexFile || replayFile;
+    CaptureInfo info = CaptureInfo();
+    if (replayFile) {
+        std::vector<CaptureRecord> records;
+        if (!readCapture(replayFile, records, info)) {
+            fprintf(stderr, "Cannot read capture %s\n", replayFile);
+            return 2;
+        }
+        printf("capture: %lu chunks (%lu missing), %lu bytes\n", info.chunks, info.missing, info.bytes);
+        replayCapture(records, unit, speed);
+    } else if (hexFile) {
+        if (!unit.loadHex(hexFile)) {
+            fprintf(stderr, "Cannot read %s\n", hexFile);
+            return 2;
+        }
+    } else {
+        // Slowly drifting temperatures around 20 degrees
+        for (unsigned long i = 0; i < frames; i++) {
+            uint8_t base = (uint8_t)(80 + (i % 8));
+            unit.queueTemperatures(base, base - 20, base - 4, base + 2, base - 15);
+        }
+    }
+
+    // Replies to the polling plan (data lengths as sent by a ComfoAir 350)
+    const uint8_t replies[][2 + 20] = {
+        { 0x0B, 6, 0x23, 0x23, 0x05, 0x7F, 0x05, 0x7F },
+        { 0x0D, 4, 0x00, 0x01, 0x00, 0x00 },
+        { 0x11, 5, 0x55, 0x3C, 0x50, 0x57, 0x41 },
+        { 0xCD, 14, 0x0F, 0x28, 0x46, 0x0F, 0x23, 0x3C, 0x23, 0x23, 0x03, 0x01, 0x46, 0x50, 0x00, 0x00 },
+        { 0xD1, 9, 0x55, 0x3C, 0x50, 0x57, 0x41, 0x0F, 0x28, 0x28, 0x28 },
+        { 0xD9, 17, 0 },
+        { 0xDD, 20, 0 },
+        { 0xDF, 7, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00 }
+    };
+    for (size_t i = 0; i < sizeof(replies) / sizeof(replies[0]); i++) {
+        unit.answer(replies[i][0], &replies[i][2], replies[i][1]);
+    }
+    // A recording already contains the requests and replies of the original
+    // session: do not poll on top of it
+    unit.setAnswering(!recorded);
+    unit.setReplyGap(replyGap);
+    pollSuspend(recorded);
+
+    // Further units (ZEHNDER_UNITS > 1) on Serial2 and Serial3 always run
+    // generated traffic
+    HardwareSerial* const ports[] = { &Serial2, &Serial3 };
+    std::vector<FakeUnit*> others;
+    for (uint8_t n = 1; n < ZEHNDER_UNITS; n++) {
+        FakeUnit* other = new FakeUnit(*ports[n - 1], (unsigned long)(960 * speed));
+        for (unsigned long i = 0; i < frames; i++) {
+            uint8_t base = (uint8_t)(70 + 10 * n + (i % 8));
+            other->queueTemperatures(base, base - 20, base - 4, base + 2, base - 15);
+        }
+        for (size_t i = 0; i < sizeof(replies) / sizeof(replies[0]); i++) {
+            other->answer(replies[i][0], &replies[i][2], replies[i][1]);
+        }
+        others.push_back(other);
+    }
+    // Advances all units; TRUE once every unit has sent everything
+    auto stepUnits = [&]() {
+        unit.step();
+        bool done = unit.done();
+        for (size_t n = 0; n < others.size(); n++) {
+            others[n]->step();
+            done = done && others[n]->done();
+        }
+        return done;
+    };
+
+    if (eepromFile) EEPROM.load(eepromFile);
+    setup();
+    // Give the firmware time to connect to the broker before traffic starts;
+    // the units only answer the poller meanwhile
+    unit.setHolding(true);
+    for (size_t n = 0; n < others.size(); n++) others[n]->setHolding(true);
+    for (int i = 0; (i < 1000) && (fakeBroker.connects == 0); i++) {
+        stepUnits();
+        loop();
+        delay(10);
+    }
+    unit.setHolding(false);
+    for (size_t n = 0; n < others.size(); n++) others[n]->setHolding(false);
+    unsigned long trafficStart = millis();
+    for (size_t i = 0; i < commands.size(); i++) {
+        fakeBroker.send(MQTTSUBTOPIC, commands[i]);
+    }
+    // Broker outage and network restart, by time since traffic started
+    auto scenario = [&]() {
+        unsigned long t = millis() - trafficStart;
+        fakeBroker.online = !((t >= outageFrom) && (t < outageTo));
+        if (reinitAt && t >= reinitAt) {
+            networkInit();
+            reinitAt = 0;
+        }
+    };
+    while (!stepUnits()) {
+        scenario();
+        loop();
+        delay(1);
+    }
+    // Let the firmware drain whatever is left, including the publish window
+    // and a reconnect after an outage
+    for (unsigned long end = millis() + PUBLISH_WINDOW + MQTT_RECONNECT_MAX + 1000; millis() < end; ) {
+        scenario();
+        stepUnits();
+        loop();
+        delay(10);
+    }
+    // Stop answering and let the last replies arrive
+    unit.setAnswering(false);
+    for (size_t n = 0; n < others.size(); n++) others[n]->setAnswering(false);
+    while (!stepUnits()) {
+        loop();
+        delay(1);
+    }
+
+#ifdef HTTP_ENABLE
+    // The status endpoint has to answer without the broker, and over a
+    // connection that takes a little at a time
+    fakeBroker.online = false;
+    std::string httpValues = httpGet("/values", 48);
+    std::string httpStats = httpGet("/stats");
+    std::vector<std::string> httpResponses;
+    for (size_t i = 0; i < httpPaths.size(); i++) {
+        httpResponses.push_back(httpGet(httpPaths[i]));
+    }
+#endif
+
+#ifdef PERSIST_ENABLE
+    PersistCounters lifetime;
+    persistTotals(lifetime);
+#endif
+
+    const CADecoderStats& stats = zehnderDecoders[0].stats();
+    printf("\n=== SIMULATION ===\n");
+    printf("bytes sent:        %lu\n", unit.bytes());
+    printf("uart overflows:    %u\n", zehnderUarts[0]->stats().overflows);
+    printf("poll requests:     %lu (unit saw %lu)\n", (unsigned long)pollStats(0).requests, unit.requests());
+    printf("poll replies:      %lu\n", (unsigned long)pollStats(0).replies);
+    printf("poll timeouts:     %u (%u late replies)\n", pollStats(0).timeouts, pollStats(0).late);
+    printf("control:           %u received, %u rejected, %u acked, %u failed, max latency %u ms\n",
+           controlStats(0).received, controlStats(0).rejected, controlStats(0).acked, controlStats(0).failed,
+           controlStats(0).maxLatency);
+#ifdef BUS_ENABLE
+    printf("bus:               %lu requests, %lu replies, %u timeouts, %u without ack, %u unmatched, "
+           "%u unsolicited, max %u ms\n",
+           (unsigned long)busStats(0).requests, (unsigned long)busStats(0).replies, busStats(0).timeouts,
+           busStats(0).noAcks, busStats(0).unmatched, busStats(0).unsolicited, busStats(0).maxLatency);
+#endif
+    printf("frames decoded:    %lu\n", (unsigned long)stats.frames);
+    printf("checksum errors:   %u\n", stats.checksumErrors);
+    printf("framing errors:    %u\n", stats.framingErrors);
+    printf("noise bytes:       %lu\n", (unsigned long)stats.noiseBytes);
+    unsigned long dataBytes = 0;
+    for (size_t i = 0; i < fakeBroker.messages.size(); i++) {
+        if (fakeBroker.messages[i].topic == MQTTPUBTOPIC_DATA) dataBytes += fakeBroker.messages[i].payload.size();
+    }
+    printf("mqtt data msgs:    %lu (%lu bytes)\n", (unsigned long)fakeBroker.count(MQTTPUBTOPIC_DATA), dataBytes);
+    printf("network:           state %u, %lu dhcp offers, %lu acks, %lu naks, %lu renews, %lu rebinds, "
+           "%lu malformed, %lu ethernet begins, %lu listens\n", networkState(), fakeNetwork.offers, fakeNetwork.acks,
+           fakeNetwork.naks, fakeNetwork.renews, fakeNetwork.rebinds, fakeNetwork.malformed, Ethernet.begins,
+           Ethernet.listens);
+    printf("mqtt connects:     %lu\n", fakeBroker.connects);
+    printf("mqtt queue drops:  %u\n", mqttQueueStats().dropped);
+    for (size_t n = 0; n < others.size(); n++) {
+        const CADecoderStats& other = zehnderDecoders[n + 1].stats();
+        printf("unit %u:            %lu/%lu frames, %lu poll replies, %u crc, %u framing, %u overflows\n",
+               (unsigned)(n + 1), (unsigned long)other.frames, others[n]->frames(),
+               (unsigned long)pollStats(n + 1).replies, other.checksumErrors, other.framingErrors,
+               zehnderUarts[n + 1]->stats().overflows);
+    }
+#ifdef HTTP_ENABLE
+    printf("http:              /values %.3s (%lu bytes), /stats %.3s (%lu bytes)\n",
+           httpValues.c_str() + std::min<size_t>(9, httpValues.size()), (unsigned long)httpValues.size(),
+           httpStats.c_str() + std::min<size_t>(9, httpStats.size()), (unsigned long)httpStats.size());
+    for (size_t i = 0; i < httpResponses.size(); i++) {
+        printf("  GET %s\n%s\n", httpPaths[i], httpResponses[i].c_str());
+    }
+#endif
+#ifdef PERSIST_ENABLE
+    printf("persist:           boot %lu, %lu frames in lifetime\n",
+           (unsigned long)lifetime.boots, (unsigned long)lifetime.units[0].frames);
+#endif
+#ifdef CAPTURE_ENABLE
+    printf("capture:           %lu bytes, %u chunks, %u dropped\n", (unsigned long)captureStats().bytes,
+           captureStats().chunks, captureStats().dropped);
+#endif
+    for (size_t i = 0; i < fakeBroker.messages.size(); i++) {
+        const BrokerMessage& msg = fakeBroker.messages[i];
+        if (msg.topic == MQTTPUBTOPIC_CAPTURE) continue;          // Binary; see --capture
+        TelemetryMessage telemetry;
+        if (isTelemetry(msg.payload.data(), msg.payload.size())) {
+            // Binary data message (PUBLISH_BINARY): print it as text
+            bool valid = decodeTelemetry(msg.payload.data(), msg.payload.size(), telemetry);
+            printf("  [%8lu] %s (%u bytes) %s\n", msg.time, msg.topic.c_str(), (unsigned)msg.payload.size(),
+                   valid ? formatTelemetry(telemetry).c_str() : "MALFORMED");
+            continue;
+        }
+        printf("  [%8lu] %s %s%s\n", msg.time, msg.topic.c_str(), msg.text().c_str(), msg.retained ? " (retained)" : "");
+    }
+
+    // Generated streams are clean: every frame must decode
+    if (captureFile && !writeCapture(captureFile, fakeBroker, MQTTPUBTOPIC_CAPTURE)) {
+        fprintf(stderr, "Cannot write capture %s\n", captureFile);
+        return 2;
+    }
+    if (!recorded && (stats.frames != unit.frames() || stats.checksumErrors || stats.framingErrors)) {
+        printf("FAILED: expected %lu frames\n", unit.frames());
+        return 1;
+    }
+    // With the broker online throughout, every unit's messages must fit
+    if (outageTo <= outageFrom && mqttQueueStats().dropped) {
+        printf("FAILED: %u messages dropped from the MQTT queue\n", mqttQueueStats().dropped);
+        return 1;
+    }
+    // A second listening socket for the same server is a leak on the W5500
+    if (Ethernet.listens > 1) {
+        printf("FAILED: HTTP server began listening %lu times\n", Ethernet.listens);
+        return 1;
+    }
+    if (fakeNetwork.malformed) {
+        printf("FAILED: %lu DHCP requests against RFC 2131\n", fakeNetwork.malformed);
+        return 1;
+    }
+    // A capture with gaps cannot be replayed faithfully
+    if (info.missing) {
+        printf("FAILED: %lu chunks missing from %s\n", info.missing, replayFile);
+        return 1;
+    }
+#ifdef CAPTURE_ENABLE
+    if (captureStats().dropped) {
+        printf("FAILED: %u capture chunks dropped\n", captureStats().dropped);
+        return 1;
+    }
+#endif
+#ifdef HTTP_ENABLE
+    if (httpValues.compare(0, 12, "HTTP/1.1 200") != 0 || httpStats.compare(0, 12, "HTTP/1.1 200") != 0) {
+        printf("FAILED: no status over HTTP\n");
+        return 1;
+    }
+    // Both bodies must be complete, /values although written in parts
+    const std::string end = "]}\n";
+    if (httpValues.size() < end.size() || httpValues.compare(httpValues.size() - end.size(), end.size(), end) != 0 ||
+        httpStats.size() < end.size() || httpStats.compare(httpStats.size() - end.size(), end.size(), end) != 0) {
+        printf("FAILED: incomplete response over HTTP\n");
+        return 1;
+    }
+#endif
+    for (size_t n = 0; n < others.size(); n++) {
+        if (zehnderDecoders[n + 1].stats().frames != others[n]->frames()) {
+            printf("FAILED: expected %lu frames on unit %u\n", others[n]->frames(), (unsigned)(n + 1));
+            return 1;
+        }
+        delete others[n];
+    }
+
+#ifdef PERSIST_ENABLE
+    // Write what a restart should start from. This runs the board on for
+    // hours, so it comes after everything else: run until a look for
+    // changes has written a record whatever changed (the counters are due
+    // after PERSIST_REFRESH), then until the writes have stopped for longer
+    // than it takes to compare a whole record.
+    if (eepromFile) {
+        unsigned long written = EEPROM.writes;
+        for (unsigned long end = millis() + PERSIST_REFRESH + PERSIST_INTERVAL; millis() < end; ) {
+            loop();
+            delay(1000);
+        }
+        for (unsigned int idle = 0; idle < (E2END + 1) / PERSIST_CHUNK; ) {
+            unsigned long before = EEPROM.writes;
+            loop();
+            delay(10);
+            idle = (EEPROM.writes == before) ? idle + 1 : 0;
+        }
+        if (EEPROM.writes == written || !EEPROM.save(eepromFile)) {
+            printf("FAILED: cannot save %s\n", eepromFile);
+            return 1;
+        }
+        printf("eeprom:            %lu bytes written, image saved to %s\n", EEPROM.writes, eepromFile);
+    }
+#endif
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if ((argc > 1) && !strcmp(argv[1], "--bench")) {
+        return runBenchmark(argc, argv);
+    }
+    if ((argc > 1) && !strcmp(argv[1], "--check")) {
+        return runChecks(argc, argv);
+    }
+    return runSimulation(argc, argv);
+}
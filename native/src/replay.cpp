@@ -0,0 +1,112 @@
+/* =============================================================================
+   Replay.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "replay.h"
+#include "../../src/capture.h"
+
+// ---------------------------------------------------------------------------
+// PARSECAPTURECHUNK
+// ---------------------------------------------------------------------------
+// Appends the records of one chunk, with absolute timestamps.
+//
+// OUTPUTS:
+//    bool           FALSE if the chunk is malformed
+// ---------------------------------------------------------------------------
+
+bool parseCaptureChunk(const uint8_t* chunk, size_t length, std::vector<CaptureRecord>& records) {
+    if (length < CAPTURE_HEADERSIZE || chunk[0] != 'C' || chunk[1] != 'A' || chunk[2] != CAPTURE_VERSION) {
+        return false;
+    }
+    unsigned long time = 0;
+    for (int i = 3; i >= 0; i--) time = (time << 8) | chunk[5 + i];
+
+    size_t pos = CAPTURE_HEADERSIZE;
+    while (pos < length) {
+        unsigned long delta = 0;
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (pos >= length || shift > 28) return false;
+            b = chunk[pos++];
+            delta |= (unsigned long)(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        if (pos >= length) return false;
+        size_t count = chunk[pos++];
+        if (count == 0 || pos + count > length) return false;
+
+        time += delta;
+        CaptureRecord record;
+        record.time = time;
+        record.bytes.assign(chunk + pos, chunk + pos + count);
+        records.push_back(record);
+        pos += count;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// READCAPTURE
+// ---------------------------------------------------------------------------
+// Loads a capture file: chunks, each preceded by a uint16 (LE) length.
+// ---------------------------------------------------------------------------
+
+bool readCapture(const char* path, std::vector<CaptureRecord>& records, CaptureInfo& info) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    info.chunks = info.missing = info.bytes = 0;
+    bool ok = true;
+    int lastSequence = -1;
+    uint8_t size[2];
+    std::vector<uint8_t> chunk;
+    while (fread(size, 1, 2, f) == 2) {
+        chunk.resize(size[0] | (size[1] << 8));
+        if (fread(chunk.data(), 1, chunk.size(), f) != chunk.size() ||
+            !parseCaptureChunk(chunk.data(), chunk.size(), records)) {
+            ok = false;
+            break;
+        }
+        int sequence = chunk[3] | (chunk[4] << 8);
+        if (lastSequence >= 0) info.missing += (uint16_t)(sequence - lastSequence - 1);
+        lastSequence = sequence;
+        info.chunks++;
+    }
+    fclose(f);
+    for (size_t i = 0; i < records.size(); i++) info.bytes += records[i].bytes.size();
+    return ok;
+}
+
+// Writes every message the broker received on "topic" as a capture file
+bool writeCapture(const char* path, const FakeBroker& broker, const char* topic) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    for (size_t i = 0; i < broker.messages.size(); i++) {
+        const BrokerMessage& msg = broker.messages[i];
+        if (msg.topic != topic) continue;
+        uint8_t size[2] = { (uint8_t)(msg.payload.size() & 0xFF), (uint8_t)(msg.payload.size() >> 8) };
+        fwrite(size, 1, 2, f);
+        fwrite(msg.payload.data(), 1, msg.payload.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+// ---------------------------------------------------------------------------
+// REPLAYCAPTURE
+// ---------------------------------------------------------------------------
+// Queues the records on the simulated unit so they arrive with the recorded
+// spacing, divided by "speed". The unit should send at the line rate times
+// "speed" as well.
+// ---------------------------------------------------------------------------
+
+void replayCapture(const std::vector<CaptureRecord>& records, FakeUnit& unit, double speed) {
+    const double byteMillis = 1000.0 / 960.0;
+    double lineFree = 0;                        // Recorded time at which the previous record was on the wire
+    for (size_t i = 0; i < records.size(); i++) {
+        double start = (double)(records[i].time - records[0].time);
+        double gap = (i > 0 && start > lineFree) ? (start - lineFree) / speed : 0;
+        unit.queueBytes(records[i].bytes.data(), records[i].bytes.size(), (unsigned long)gap);
+        lineFree = ((start > lineFree) ? start : lineFree) + records[i].bytes.size() * byteMillis;
+    }
+}
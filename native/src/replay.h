@@ -0,0 +1,32 @@
+/* =============================================================================
+   Replay.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Reading and writing raw bus captures (format: see src/capture.h).
+
+#ifndef __COMFOAIR_NATIVE_REPLAY_H
+#define __COMFOAIR_NATIVE_REPLAY_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "sim.h"
+
+struct CaptureRecord {
+    unsigned long time;                         // millis() on the capturing board
+    std::vector<uint8_t> bytes;
+};
+
+struct CaptureInfo {
+    unsigned long chunks;
+    unsigned long missing;                      // Chunks lost according to the sequence numbers
+    unsigned long bytes;
+};
+
+bool readCapture(const char* path, std::vector<CaptureRecord>& records, CaptureInfo& info);
+bool parseCaptureChunk(const uint8_t* chunk, size_t length, std::vector<CaptureRecord>& records);
+bool writeCapture(const char* path, const FakeBroker& broker, const char* topic);
+void replayCapture(const std::vector<CaptureRecord>& records, FakeUnit& unit, double speed);
+
+#endif
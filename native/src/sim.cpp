@@ -0,0 +1,351 @@
+/* =============================================================================
+   Sim.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "sim.h"
+#include <PubSubClient.h>
+#include <EthernetUdp.h>
+#include "../../src/zehnder.h"
+#include "../../src/decoder.h"
+
+FakeBroker fakeBroker;
+FakeNetwork fakeNetwork;
+
+/*=============================================================================
+   FAKE BROKER
+  ============================================================================= */
+
+size_t FakeBroker::count(const char* topic) const {
+    size_t n = 0;
+    for (size_t i = 0; i < messages.size(); i++) {
+        if (messages[i].topic == topic) n++;
+    }
+    return n;
+}
+
+void FakeBroker::send(const char* topic, const char* payload) {
+    BrokerMessage msg;
+    msg.topic = topic;
+    msg.payload.assign(payload, payload + strlen(payload));
+    msg.retained = false;
+    msg.time = millis();
+    inbound.push_back(msg);
+}
+
+/*=============================================================================
+   PUBSUBCLIENT (backed by the fake broker)
+  ============================================================================= */
+
+boolean PubSubClient::connect(const char* id) {
+    (void)id;
+    delay(fakeBroker.connectDelay);
+    _connected = fakeBroker.online;
+    if (_connected) fakeBroker.connects++;
+    return _connected;
+}
+
+boolean PubSubClient::connected() {
+    if (!fakeBroker.online) _connected = false;
+    return _connected;
+}
+
+boolean PubSubClient::loop() {
+    if (!connected()) return false;
+    while (!fakeBroker.inbound.empty()) {
+        BrokerMessage msg = fakeBroker.inbound.front();
+        fakeBroker.inbound.erase(fakeBroker.inbound.begin());
+        if (_callback) {
+            std::vector<uint8_t> payload = msg.payload;
+            payload.push_back(0);
+            _callback(&msg.topic[0], payload.data(), (unsigned int)msg.payload.size());
+        }
+    }
+    return true;
+}
+
+boolean PubSubClient::publish(const char* topic, const char* payload) {
+    return publish(topic, (const uint8_t*)payload, (unsigned int)strlen(payload), false);
+}
+
+boolean PubSubClient::publish(const char* topic, const char* payload, boolean retained) {
+    return publish(topic, (const uint8_t*)payload, (unsigned int)strlen(payload), retained);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength) {
+    return publish(topic, payload, plength, false);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    if (!connected()) return false;
+    // Same limit as the real library: fixed header + topic + payload must fit
+    if (5 + 2 + strlen(topic) + plength > MQTT_MAX_PACKET_SIZE) return false;
+    BrokerMessage msg;
+    msg.topic = topic;
+    msg.payload.assign(payload, payload + plength);
+    msg.retained = retained;
+    msg.time = millis();
+    fakeBroker.messages.push_back(msg);
+    return true;
+}
+
+boolean PubSubClient::subscribe(const char* topic) {
+    if (!connected()) return false;
+    fakeBroker.subscriptions.push_back(topic);
+    return true;
+}
+
+/*=============================================================================
+   FAKE NETWORK (DHCP server)
+  ============================================================================= */
+
+void FakeNetwork::send(IPAddress to, uint16_t port, const std::vector<uint8_t>& data) {
+    // BOOTREQUEST with magic cookie and message type option right behind it
+    if (!dhcp || port != 67 || data.size() < 243 || data[0] != 1 || data[240] != 53) return;
+    uint8_t type = data[242];
+    if (type != 1 && type != 3) return;
+
+    const IPAddress server(192, 168, 1, 1);
+    bool broadcast = (to == IPAddress(255, 255, 255, 255));
+    bool renewing = !(IPAddress(&data[12]) == IPAddress(0, 0, 0, 0));
+    bool requested = false;                     // Options 50 or 54 present
+
+    // A REQUEST for another address than ours (e.g. INIT-REBOOT with an old
+    // lease) is refused
+    uint8_t answer = (type == 1) ? 2 : 5;
+    for (size_t i = 240; i + 1 < data.size() && data[i] != 255; i += 2 + data[i + 1]) {
+        if (data[i] == 50 || data[i] == 54) requested = true;
+        if (type == 3 && data[i] == 50 && data[i + 1] == 4 && i + 6 <= data.size() &&
+            memcmp(&data[i + 2], address.raw(), 4) != 0) {
+            answer = 6;
+        }
+    }
+    if (renewing) {
+        if (type != 3 || requested || !(broadcast || to == server)) {
+            malformed++;
+            return;
+        }
+        if (!broadcast && !unicast) return;
+        if (broadcast) rebinds++; else renews++;
+        if (memcmp(&data[12], address.raw(), 4) != 0) answer = 6;
+    } else if (!broadcast) {
+        malformed++;
+        return;
+    }
+
+    std::vector<uint8_t> reply(240, 0);
+    reply[0] = 2;                               // BOOTREPLY
+    reply[1] = 1;
+    reply[2] = 6;
+    memcpy(&reply[4], &data[4], 4);             // Transaction id
+    memcpy(&reply[16], address.raw(), 4);       // Your address
+    memcpy(&reply[28], &data[28], 6);           // Client MAC
+    const uint8_t cookie[] = { 0x63, 0x82, 0x53, 0x63 };
+    memcpy(&reply[236], cookie, 4);
+    const uint8_t options[] = {
+        53, 1, answer,
+        54, 4, server[0], server[1], server[2], server[3],
+        51, 4, (uint8_t)(leaseTime >> 24), (uint8_t)(leaseTime >> 16), (uint8_t)(leaseTime >> 8), (uint8_t)leaseTime,
+        1, 4, 255, 255, 255, 0,
+        3, 4, 192, 168, 1, 1,
+        6, 4, 192, 168, 1, 1,
+        255
+    };
+    reply.insert(reply.end(), options, options + sizeof(options));
+    if (answer == 2) offers++; else if (answer == 5) acks++; else naks++;
+
+    Datagram d;
+    d.from = server;
+    d.data = reply;
+    inbound.push_back(d);
+}
+
+/*=============================================================================
+   ETHERNETUDP (backed by the fake network)
+  ============================================================================= */
+
+int EthernetUDP::beginPacket(IPAddress ip, uint16_t port) {
+    _destination = ip;
+    _destinationPort = port;
+    _out.clear();
+    return _port != 0;
+}
+
+int EthernetUDP::endPacket() {
+    fakeNetwork.send(_destination, _destinationPort, _out);
+    _out.clear();
+    return 1;
+}
+
+int EthernetUDP::parsePacket() {
+    _in.clear();
+    _pos = 0;
+    if (_port == 0 || fakeNetwork.inbound.empty()) return 0;
+    _in = fakeNetwork.inbound.front().data;
+    _remote = fakeNetwork.inbound.front().from;
+    fakeNetwork.inbound.pop_front();
+    return (int)_in.size();
+}
+
+int EthernetUDP::read(uint8_t* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length && _pos < _in.size()) buffer[n++] = _in[_pos++];
+    return (int)n;
+}
+
+/*=============================================================================
+   FAKE COMFOAIR UNIT
+  ============================================================================= */
+
+FakeUnit::FakeUnit(HardwareSerial& port, unsigned long bytesPerSecond)
+    : _port(port), _byteMicros(1000000UL / bytesPerSecond), _next(0), _idle(true), _chunk(0), _offset(0),
+      _frames(0), _bytes(0), _requests(0), _answering(true), _replyGap(2), _holding(false), _txPos(0),
+      _answers(256), _answered(256, false) {
+}
+
+std::vector<uint8_t> FakeUnit::encode(uint8_t cmd, const uint8_t* data, uint8_t length, bool ack) {
+    uint8_t buf[CADEC_FRAMESIZE];
+    std::vector<uint8_t> out(buf, buf + caEncodeFrame(cmd, data, length, buf));
+    if (ack) {
+        out.push_back(0x07);
+        out.push_back(0xF3);
+    }
+    return out;
+}
+
+void FakeUnit::queueBytes(const uint8_t* data, size_t length, unsigned long gap) {
+    Chunk chunk;
+    chunk.bytes.assign(data, data + length);
+    chunk.gap = gap;
+    chunk.reply = false;
+    _chunks.push_back(chunk);
+}
+
+void FakeUnit::queueFrame(uint8_t cmd, const uint8_t* data, uint8_t length, bool ack, unsigned long gap) {
+    std::vector<uint8_t> frame = encode(cmd, data, length, ack);
+    queueBytes(frame.data(), frame.size(), gap);
+    _frames++;
+}
+
+void FakeUnit::queueTemperatures(uint8_t comfort, uint8_t t1, uint8_t t2, uint8_t t3, uint8_t t4) {
+    // Panel request (0xD1) after a pause, followed by the unit's 0xD2 reply
+    queueFrame(0xD1, NULL, 0, true, 50);
+    const uint8_t data[9] = { comfort, t1, t2, t3, t4, 0x0F, 0x28, 0x28, 0x28 };
+    queueFrame(0xD2, data, sizeof(data), true, 5);
+}
+
+// Reply with "data" (as command request + 1) whenever "request" is received
+void FakeUnit::answer(uint8_t request, const uint8_t* data, uint8_t length) {
+    _answers[request].assign(data, data + length);
+    _answered[request] = true;
+}
+
+// ---------------------------------------------------------------------------
+// LOADHEX
+// ---------------------------------------------------------------------------
+// Loads a recorded byte stream written as hex digits. Whitespace is ignored,
+// '#' starts a comment until the end of the line.
+// ---------------------------------------------------------------------------
+
+bool FakeUnit::loadHex(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    std::vector<uint8_t> data;
+    int c, nibble = -1;
+    bool comment = false;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '\n') { comment = false; continue; }
+        if (comment) continue;
+        if (c == '#') { comment = true; continue; }
+        int v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else continue;
+        if (nibble < 0) {
+            nibble = v;
+        } else {
+            data.push_back((uint8_t)((nibble << 4) | v));
+            nibble = -1;
+        }
+    }
+    fclose(f);
+    queueBytes(data.data(), data.size());
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// LISTEN
+// ---------------------------------------------------------------------------
+// Decodes what the firmware transmitted since the last call. Every frame is
+// acknowledged right after the chunk on the line now, just like the unit
+// would once the bus is free; requests we know are answered as well.
+// ---------------------------------------------------------------------------
+
+void FakeUnit::listen() {
+    static ComfoAirDecoder decoder;
+    std::vector<uint8_t>& tx = _port.txLog();
+    for (; _txPos < tx.size(); _txPos++) {
+        if (decoder.push(tx[_txPos]) != CADEC_FRAME) continue;
+        _requests++;
+        if (!_answering) continue;
+
+        uint8_t cmd = decoder.commandByte();
+        Chunk reply;
+        reply.bytes.assign(cacmd_AckCMD, cacmd_AckCMD + sizeof(cacmd_AckCMD));
+        if (_answered[cmd]) {
+            const std::vector<uint8_t>& data = _answers[cmd];
+            std::vector<uint8_t> frame = encode(cmd + 1, data.data(), (uint8_t)data.size(), false);
+            reply.bytes.insert(reply.bytes.end(), frame.begin(), frame.end());
+            _frames++;
+        }
+        reply.gap = _replyGap;
+        reply.reply = true;
+        // Behind the chunk on the line and earlier answers still waiting
+        size_t at = (_offset > 0) ? _chunk + 1 : _chunk;
+        while (at < _chunks.size() && _chunks[at].reply) at++;
+        _chunks.insert(_chunks.begin() + at, reply);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// STEP
+// ---------------------------------------------------------------------------
+// Hands all bytes that are due according to the line rate to the serial port.
+// ---------------------------------------------------------------------------
+
+size_t FakeUnit::step() {
+    listen();
+    unsigned long now = micros();
+    size_t sent = 0;
+    while (_chunk < _chunks.size()) {
+        const Chunk& chunk = _chunks[_chunk];
+        if (_holding && !chunk.reply && _offset == 0) {
+            _idle = true;                       // Pace from the release on
+            break;
+        }
+        if (_idle) {
+            _next = now;
+            _idle = false;
+        }
+        // A chunk's silence starts once the previous chunk is out
+        unsigned long begin = _next + ((_offset == 0) ? chunk.gap * 1000UL : 0);
+        if ((long)(now - begin) < 0) break;
+        size_t due = (now - begin) / _byteMicros + 1;
+        size_t left = chunk.bytes.size() - _offset;
+        if (due > left) due = left;
+        _port.inject(&chunk.bytes[_offset], due);
+        _offset += due;
+        _next = begin + due * _byteMicros;
+        sent += due;
+        _bytes += due;
+        if (_offset == chunk.bytes.size()) {
+            _chunk++;
+            _offset = 0;
+        }
+    }
+    if (_chunk >= _chunks.size()) {
+        _idle = true;
+    }
+    return sent;
+}
@@ -0,0 +1,151 @@
+/* =============================================================================
+   Sim.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Simulated ComfoAir unit and MQTT broker for host builds.
+
+#ifndef __COMFOAIR_NATIVE_SIM_H
+#define __COMFOAIR_NATIVE_SIM_H
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/* --------------------------------------------------------------------------
+   Fake MQTT broker
+   -------------------------------------------------------------------------- */
+
+struct BrokerMessage {
+    std::string topic;
+    std::vector<uint8_t> payload;
+    bool retained;
+    unsigned long time;                         // millis() at publish time
+
+    std::string text() const { return std::string(payload.begin(), payload.end()); }
+};
+
+class FakeBroker {
+    public:
+        FakeBroker() : online(true), connectDelay(0), connects(0) {}
+
+        bool online;                            // Broker reachable?
+        unsigned long connectDelay;             // Simulated (blocking) connect time in ms
+        unsigned long connects;                 // Number of successful connects
+        std::vector<BrokerMessage> messages;    // Everything published so far
+        std::vector<std::string> subscriptions;
+        std::vector<BrokerMessage> inbound;     // Messages waiting to be delivered to the client
+
+        void clear()                            { messages.clear(); inbound.clear(); }
+        size_t count(const char* topic) const;
+        void send(const char* topic, const char* payload);
+};
+
+extern FakeBroker fakeBroker;
+
+/* --------------------------------------------------------------------------
+   Fake network
+   --------------------------------------------------------------------------
+   Receives the firmware's UDP datagrams. With a DHCP server present,
+   DISCOVER and REQUEST are answered with OFFER and ACK for "address"; a
+   REQUEST for any other address gets a NAK.
+
+   A REQUEST that renews a lease (our address in ciaddr) must not carry
+   options 50 and 54, and may only be unicast to the server itself (RFC
+   2131 4.3.2); other requests must be broadcast. Requests that break
+   these rules are counted as malformed and not answered. Without
+   "unicast", renewals go unanswered until they are broadcast (REBINDING).
+   -------------------------------------------------------------------------- */
+
+struct Datagram {
+    IPAddress from;
+    std::vector<uint8_t> data;
+};
+
+class FakeNetwork {
+    public:
+        FakeNetwork()
+            : dhcp(true), unicast(true), address(192, 168, 1, 70), leaseTime(3600), offers(0), acks(0), naks(0),
+              renews(0), rebinds(0), malformed(0) {}
+
+        bool dhcp;                              // DHCP server present?
+        bool unicast;                           // Server answers unicast requests?
+        IPAddress address;                      // Address handed out
+        uint32_t leaseTime;                     // Seconds
+        unsigned long offers;
+        unsigned long acks;
+        unsigned long naks;
+        unsigned long renews;                   // Renewing requests (unicast)
+        unsigned long rebinds;                  // Rebinding requests (broadcast)
+        unsigned long malformed;
+        std::deque<Datagram> inbound;           // Waiting for the firmware's socket
+
+        void send(IPAddress to, uint16_t port, const std::vector<uint8_t>& data);
+};
+
+extern FakeNetwork fakeNetwork;
+
+/* --------------------------------------------------------------------------
+   Fake ComfoAir unit
+   --------------------------------------------------------------------------
+   Produces a byte stream on a simulated serial port, paced at the line rate
+   (9600 baud = 960 bytes/s) against the virtual clock. The stream is a list
+   of chunks (usually one frame each) with an optional silence before them.
+   Frames the firmware sends on the port are acknowledged, and requests with
+   a configured reply are answered; both go onto the line right after the
+   chunk being sent, after a gap of 2 ms (see setReplyGap()). While
+   holding, only those go out and the queued stream waits.
+   -------------------------------------------------------------------------- */
+
+class FakeUnit {
+    public:
+        FakeUnit(HardwareSerial& port, unsigned long bytesPerSecond = 960);
+
+        void queueBytes(const uint8_t* data, size_t length, unsigned long gap = 0);
+        void queueFrame(uint8_t cmd, const uint8_t* data, uint8_t length, bool ack = true, unsigned long gap = 0);
+        void queueTemperatures(uint8_t comfort, uint8_t t1, uint8_t t2, uint8_t t3, uint8_t t4);
+        bool loadHex(const char* path);
+
+        void answer(uint8_t request, const uint8_t* data, uint8_t length);
+        void setAnswering(bool answering)       { _answering = answering; }
+        void setReplyGap(unsigned long gap)     { _replyGap = gap; }
+        void setHolding(bool holding)           { _holding = holding; }
+
+        size_t step();                          // Deliver all bytes that are due by now
+        bool done() const                       { return _chunk >= _chunks.size(); }
+        unsigned long frames() const            { return _frames; }
+        unsigned long bytes() const             { return _bytes; }
+        unsigned long requests() const          { return _requests; }
+
+    private:
+        struct Chunk {
+            std::vector<uint8_t> bytes;
+            unsigned long gap;                  // Silence before this chunk (ms)
+            bool reply;                         // ACK/reply to something the firmware sent
+        };
+
+        HardwareSerial& _port;
+        unsigned long _byteMicros;
+        unsigned long _next;                    // micros() at which the next byte may go
+        bool _idle;                             // Line ran dry; restart pacing on new data
+        size_t _chunk;                          // Chunk being sent
+        size_t _offset;                         // Position within that chunk
+        unsigned long _frames;
+        unsigned long _bytes;
+        unsigned long _requests;
+        std::vector<Chunk> _chunks;
+
+        bool _answering;
+        unsigned long _replyGap;                // Silence before an ACK/reply (ms)
+        bool _holding;                          // Only ACKs/replies go out; queued traffic waits
+        size_t _txPos;                          // Bytes of the port's TX log already looked at
+        std::vector<std::vector<uint8_t> > _answers;  // Reply data per request command (empty = none)
+        std::vector<bool> _answered;
+
+        void listen();
+        std::vector<uint8_t> encode(uint8_t cmd, const uint8_t* data, uint8_t length, bool ack);
+};
+
+#endif
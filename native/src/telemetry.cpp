@@ -0,0 +1,120 @@
+/* =============================================================================
+   Telemetry.cpp (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "telemetry.h"
+#include "../../src/publish.h"
+#include "../../src/commands.h"
+
+// Looks up the table row of a field; FALSE if the firmware does not know it
+static bool findField(uint8_t command, uint8_t offset, CAField& field) {
+    for (uint8_t i = caFindCommand(command); i < CAFIELD_COUNT; i++) {
+        caReadField(i, field);
+        if (field.command != command) break;
+        if (field.offset == offset) return true;
+    }
+    return false;
+}
+
+static double scaleValue(const CAField& field, long value) {
+    switch (field.scale) {
+        case CASCALE_TEMP:
+            return caTemperature((uint8_t)value) / 100.0;
+        case CASCALE_RPM:
+            return (value > 0) ? (double)(1875000L / value) : 0;
+        default:
+            return (double)value;
+    }
+}
+
+bool isTelemetry(const uint8_t* payload, size_t length) {
+    return (length >= PUBLISH_BINARY_HEADERSIZE) && (payload[0] == 'C') && (payload[1] == 'T');
+}
+
+// ---------------------------------------------------------------------------
+// DECODETELEMETRY
+// ---------------------------------------------------------------------------
+// Splits a binary data message into its fields.
+//
+// OUTPUTS:
+//    bool           FALSE if the message is malformed, of an unknown version,
+//                   or holds a field that is not in caFields[] (its width is
+//                   then unknown, so nothing after it can be read)
+// ---------------------------------------------------------------------------
+
+bool decodeTelemetry(const uint8_t* payload, size_t length, TelemetryMessage& message) {
+    message.fields.clear();
+    if (!isTelemetry(payload, length) || payload[2] != PUBLISH_BINARY_VERSION) {
+        return false;
+    }
+    message.version = payload[2];
+    message.flags = payload[3];
+    int values = (message.flags & PUBLISH_FLAG_AGGREGATE) ? 3 : 1;
+
+    size_t pos = PUBLISH_BINARY_HEADERSIZE;
+    while (pos < length) {
+        if (pos + 2 > length) return false;
+        uint8_t command = payload[pos++];
+        uint8_t count = payload[pos++];
+        for (uint8_t n = 0; n < count; n++) {
+            CAField field;
+            if (pos >= length || !findField(command, payload[pos], field)) return false;
+            pos++;
+            if (pos + values * field.width > length) return false;
+
+            long raw[3];
+            for (int v = 0; v < values; v++) {
+                unsigned long value = 0;
+                for (uint8_t b = 0; b < field.width; b++) value = (value << 8) | payload[pos++];
+                raw[v] = (long)value;
+            }
+            TelemetryField out;
+            out.command = command;
+            out.offset = field.offset;
+            out.key = reinterpret_cast<const char*>(field.key);
+            out.value = raw[0];
+            out.min = (values == 3) ? raw[1] : raw[0];
+            out.max = (values == 3) ? raw[2] : raw[0];
+            out.scaled = scaleValue(field, out.value);
+            message.fields.push_back(out);
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// FORMATTELEMETRY
+// ---------------------------------------------------------------------------
+// Renders a decoded message exactly like the firmware's text payload.
+// ---------------------------------------------------------------------------
+
+std::string formatTelemetry(const TelemetryMessage& message) {
+    char buffer[1024];
+    PayloadWriter payload(buffer, sizeof(buffer));
+    int group = -1;
+    for (size_t i = 0; i < message.fields.size(); i++) {
+        const TelemetryField& value = message.fields[i];
+        CAField field;
+        findField(value.command, value.offset, field);
+        if (group != value.command) {
+            if (payload.length() > 0) payload.append("; ");
+            payload.append("command=");
+            payload.appendHex(value.command);
+            payload.append(' ');
+            group = value.command;
+        } else {
+            payload.append(',');
+        }
+        caAppendKey(payload, field);
+        payload.append('=');
+        caAppendValue(payload, field, value.value);
+        if (message.flags & PUBLISH_FLAG_AGGREGATE) {
+            payload.append('/');
+            caAppendValue(payload, field, value.min);
+            payload.append('/');
+            caAppendValue(payload, field, value.max);
+        }
+    }
+    return std::string(payload.c_str(), payload.length());
+}
@@ -0,0 +1,37 @@
+/* =============================================================================
+   Telemetry.h (native)
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+// Decoder for binary data messages (PUBLISH_BINARY, format: see
+// src/publish.h). Fields are looked up in the same caFields[] table the
+// firmware uses, so keys and scaling always match the text payload.
+
+#ifndef __COMFOAIR_NATIVE_TELEMETRY_H
+#define __COMFOAIR_NATIVE_TELEMETRY_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+struct TelemetryField {
+    uint8_t command;
+    uint8_t offset;                             // Offset in the data block
+    std::string key;                            // Empty if the field is not in caFields[]
+    long value;                                 // Raw value (mean with PUBLISH_FLAG_AGGREGATE)
+    long min;                                   // Equal to "value" unless aggregated
+    long max;
+    double scaled;                              // "value" with the field's scaling applied
+};
+
+struct TelemetryMessage {
+    uint8_t version;
+    uint8_t flags;
+    std::vector<TelemetryField> fields;
+};
+
+bool isTelemetry(const uint8_t* payload, size_t length);
+bool decodeTelemetry(const uint8_t* payload, size_t length, TelemetryMessage& message);
+std::string formatTelemetry(const TelemetryMessage& message);
+
+#endif
@@ -0,0 +1,136 @@
+# =============================================================================
+#   Footprint.py
+#   Written in 2018 by Tim Jacobs
+# =============================================================================
+#
+# Memory footprint report: where the SRAM and flash of the firmware go, per
+# symbol, checked against a budget.
+#
+# As a PlatformIO extra script it runs after every link of the firmware and
+# fails the build when a budget is exceeded. The budgets are set per
+# environment in platformio.ini:
+#
+#    extra_scripts = post:scripts/footprint.py
+#    custom_ram_budget = 6144         ; .data + .bss, bytes (0 = no check)
+#    custom_flash_budget = 253952     ; .text + .data, bytes (0 = no check)
+#    custom_footprint_top = 20        ; Symbols listed per memory
+#
+# The report is printed and also written to footprint.txt in the build
+# directory. It can be run by hand on any ELF file as well:
+#
+#    python scripts/footprint.py .pio/build/comfoairclient/firmware.elf \
+#        [--ram BYTES] [--flash BYTES] [--top N] [--nm avr-nm]
+
+import subprocess
+import sys
+
+# Sections that take SRAM and flash. .data is in both: it is copied from
+# flash to RAM at startup.
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+FLASH_SECTIONS = (".text", ".rodata", ".data")
+
+# nm symbol types that live in RAM (initialized data, bss, weak objects)
+RAM_TYPES = "bBdDvV"
+
+
+def section_sizes(elf, size_tool):
+    """Returns {section: bytes} from "size -A"."""
+    sizes = {}
+    output = subprocess.check_output([size_tool, "-A", elf]).decode()
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".") and fields[1].isdigit():
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+
+def symbol_sizes(elf, nm_tool):
+    """Returns lists of (bytes, name) for RAM and flash symbols, largest first."""
+    ram, flash = [], []
+    output = subprocess.check_output([nm_tool, "-S", "-C", "--size-sort", elf]).decode()
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) < 4:
+            continue
+        size, kind, name = int(fields[1], 16), fields[2], fields[3]
+        (ram if kind in RAM_TYPES else flash).append((size, name))
+    ram.sort(reverse=True)
+    flash.sort(reverse=True)
+    return ram, flash
+
+
+def report(elf, ram_budget, flash_budget, top, nm_tool, size_tool):
+    """Builds the report text; returns (text, within budget?)."""
+    sections = section_sizes(elf, size_tool)
+    ram_used = sum(sections.get(s, 0) for s in RAM_SECTIONS)
+    flash_used = sum(sections.get(s, 0) for s in FLASH_SECTIONS)
+    ram_symbols, flash_symbols = symbol_sizes(elf, nm_tool)
+
+    lines = ["=== MEMORY FOOTPRINT: %s ===" % elf]
+    ok = True
+    for label, used, budget in (("SRAM", ram_used, ram_budget), ("Flash", flash_used, flash_budget)):
+        if budget:
+            verdict = "OK" if used <= budget else "OVER BUDGET"
+            ok = ok and used <= budget
+            lines.append("%-6s %7d of %7d bytes (%5.1f%%) %s" % (label, used, budget, 100.0 * used / budget, verdict))
+        else:
+            lines.append("%-6s %7d bytes" % (label, used))
+    lines.append("Sections: " + ", ".join("%s=%d" % (s, sections[s]) for s in sorted(sections)
+                                          if s in RAM_SECTIONS + FLASH_SECTIONS))
+
+    for label, symbols in (("SRAM", ram_symbols), ("Flash", flash_symbols)):
+        lines.append("")
+        lines.append("Largest %s symbols:" % label)
+        for size, name in symbols[:top]:
+            lines.append("  %7d  %s" % (size, name))
+    return "\n".join(lines), ok
+
+
+def main(argv):
+    args = {"--ram": "0", "--flash": "0", "--top": "20", "--nm": "nm", "--size": None}
+    elf = None
+    i = 1
+    while i < len(argv):
+        if argv[i] in args and i + 1 < len(argv):
+            args[argv[i]] = argv[i + 1]
+            i += 2
+        else:
+            elf = argv[i]
+            i += 1
+    if not elf:
+        print("usage: footprint.py FILE.elf [--ram BYTES] [--flash BYTES] [--top N] [--nm NM] [--size SIZE]")
+        return 2
+    size_tool = args["--size"] or args["--nm"][:-2] + "size"
+    text, ok = report(elf, int(args["--ram"]), int(args["--flash"]), int(args["--top"]), args["--nm"], size_tool)
+    print(text)
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
+else:
+    # PlatformIO extra script
+    import os
+    Import("env")  # noqa: F821
+
+    def option(name, default):
+        try:
+            return env.GetProjectOption(name)  # noqa: F821
+        except Exception:
+            return default
+
+    def footprint(source, target, env):
+        elf = str(target[0])
+        # avr-gcc -> avr-nm / avr-size, gcc -> nm / size
+        prefix = env.subst("$CC")[:-3]
+        text, ok = report(elf, int(option("custom_ram_budget", 0)), int(option("custom_flash_budget", 0)),
+                          int(option("custom_footprint_top", 20)), prefix + "nm", prefix + "size")
+        print(text)
+        with open(os.path.join(env.subst("$BUILD_DIR"), "footprint.txt"), "w") as f:
+            f.write(text + "\n")
+        if not ok:
+            sys.stderr.write("Memory budget exceeded, see footprint.txt\n")
+            return 1
+        return 0
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", footprint)  # noqa: F821
@@ -0,0 +1,330 @@
+/* =============================================================================
+   Bus.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "bus.h"
+
+#ifdef BUS_ENABLE
+
+#include "zehnder.h"
+#include "uart.h"
+#include "payload.h"
+#include "mqtt.h"
+#include "log.h"
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+#define BUSREQ_USED 0x01                        // Slot holds a request
+#define BUSREQ_OURS 0x02                        // We sent it (and acknowledge the reply ourselves)
+
+// A request waiting for its reply
+struct BusRequest {
+    uint8_t command;
+    uint8_t flags;                              // BUSREQ_*
+    unsigned long time;                         // millis() at the end of the request
+};
+
+// Response times of one request command, this interval
+struct BusCommand {
+    uint8_t command;
+    uint16_t replies;
+    uint16_t timeouts;
+    uint16_t maxLatency;
+    uint32_t sumLatency;
+    uint16_t histogram[BUS_BUCKETS];
+};
+
+// Correlation state of one unit
+struct BusUnit {
+    BusRequest pending[BUS_PENDING];
+    BusCommand commands[BUS_COMMANDS];
+    uint8_t commandCount;                       // Rows of commands[] in use (reset after every report)
+    uint8_t requested[32];                      // Commands seen as requests, one bit each (from boot)
+    bool ackWaiting;                            // A frame still needs its ACK...
+    unsigned long ackSince;                     // ... since this millis()
+    uint32_t lineBytes;                         // Bytes received + sent at the start of the interval
+    BusStats counters;
+};
+
+static BusUnit busUnits[ZEHNDER_UNITS];
+
+static unsigned long busLastReport = 0;         // millis() of the last report
+static unsigned long busInterval = 0;           // Length of the interval being reported (ms)
+static uint8_t busReportUnit = ZEHNDER_UNITS;   // Unit being reported (ZEHNDER_UNITS = none)
+static uint8_t busReportLine = 0;               // 0 = summary, then commands[] rows + 1
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// Histogram row of a request command; added if there is room (else NULL)
+static BusCommand* busCommand(BusUnit& bus, uint8_t command) {
+    for (uint8_t i = 0; i < bus.commandCount; i++) {
+        if (bus.commands[i].command == command) {
+            return &bus.commands[i];
+        }
+    }
+    if (bus.commandCount >= BUS_COMMANDS) {
+        return NULL;
+    }
+    BusCommand& row = bus.commands[bus.commandCount++];
+    memset(&row, 0, sizeof(row));
+    row.command = command;
+    return &row;
+}
+
+// Histogram bucket of a response time
+static uint8_t busBucket(uint16_t latency) {
+    uint8_t bucket = 0;
+    uint16_t limit = BUS_BUCKETBASE;
+    while (bucket < BUS_BUCKETS - 1 && latency >= limit) {
+        bucket++;
+        limit <<= 1;
+    }
+    return bucket;
+}
+
+// Gives up on a pending request
+static void busTimeout(BusUnit& bus, BusRequest& request) {
+    LOG_DEBUG(F("Bus: no reply to 0x"));
+    LOG_DEBUGLN(request.command, HEX);
+    bus.counters.timeouts++;
+    BusCommand* row = busCommand(bus, request.command);
+    if (row && row->timeouts < 0xFFFF) row->timeouts++;
+    request.flags = 0;
+}
+
+// Remembers a request until its reply arrives
+static void busRequest(BusUnit& bus, uint8_t command, uint8_t flags, unsigned long time) {
+    bus.counters.requests++;
+    bus.requested[command >> 3] |= 1 << (command & 7);
+    busCommand(bus, command);
+
+    // Same command again (the previous one was not answered), else a free
+    // slot, else the oldest request
+    uint8_t slot = 0;
+    for (uint8_t i = 0; i < BUS_PENDING; i++) {
+        BusRequest& request = bus.pending[i];
+        if ((request.flags & BUSREQ_USED) && request.command == command) {
+            slot = i;
+            break;
+        }
+        if (!(bus.pending[slot].flags & BUSREQ_USED)) {
+            continue;                           // Already found a free one
+        }
+        if (!(request.flags & BUSREQ_USED) || (long)(request.time - bus.pending[slot].time) < 0) {
+            slot = i;
+        }
+    }
+    BusRequest& request = bus.pending[slot];
+    if (request.flags & BUSREQ_USED) {
+        busTimeout(bus, request);
+    }
+    request.command = command;
+    request.flags = BUSREQ_USED | flags;
+    request.time = time;
+}
+
+// Books a frame with data as the reply to a pending request; returns the
+// flags of that request (0 = none). A frame answering a request command
+// seen before is a reply that came too late or whose request was missed;
+// any other one (a write, a status message) was sent unsolicited.
+static uint8_t busReply(BusUnit& bus, uint8_t command, unsigned long now) {
+    uint8_t requestCommand = command - 1;
+    for (uint8_t i = 0; i < BUS_PENDING; i++) {
+        BusRequest& request = bus.pending[i];
+        if (!(request.flags & BUSREQ_USED) || request.command != requestCommand) {
+            continue;
+        }
+        long elapsed = (long)(now - request.time);
+        uint16_t latency = elapsed < 0 ? 0 : (elapsed > 0xFFFF ? 0xFFFF : (uint16_t)elapsed);
+        uint8_t flags = request.flags;
+        request.flags = 0;
+
+        bus.counters.replies++;
+        if (latency > bus.counters.maxLatency) bus.counters.maxLatency = latency;
+        BusCommand* row = busCommand(bus, requestCommand);
+        if (row) {
+            if (row->replies < 0xFFFF) row->replies++;
+            row->sumLatency += latency;
+            if (latency > row->maxLatency) row->maxLatency = latency;
+            uint16_t& bucket = row->histogram[busBucket(latency)];
+            if (bucket < 0xFFFF) bucket++;
+        }
+        return flags;
+    }
+    if (bus.requested[requestCommand >> 3] & (1 << (requestCommand & 7))) {
+        bus.counters.unmatched++;
+    } else {
+        bus.counters.unsolicited++;
+    }
+    return 0;
+}
+
+// Starts waiting for the ACK of a frame; a frame still waiting has none
+static void busExpectAck(BusUnit& bus, unsigned long time) {
+    if (bus.ackWaiting) {
+        bus.counters.noAcks++;
+    }
+    bus.ackWaiting = true;
+    bus.ackSince = time;
+}
+
+// ---------------------------------------------------------------------------
+// BUSFRAME
+// ---------------------------------------------------------------------------
+// Call for every frame decoded on the line of a unit. A frame without data
+// is a request; any other frame may be the reply to one.
+//
+// INPUTS:
+//    unit           Unit the frame came from
+//    command        Command byte of the frame
+//    length         Number of data bytes
+// ---------------------------------------------------------------------------
+
+void busFrame(uint8_t unit, uint8_t command, uint8_t length) {
+    BusUnit& bus = busUnits[unit];
+    unsigned long now = millis();
+    if (bus.ackWaiting) {
+        bus.counters.noAcks++;                  // Next frame before the ACK
+        bus.ackWaiting = false;
+    }
+    if (length == 0) {
+        busRequest(bus, command, 0, now);
+    } else if (busReply(bus, command, now) & BUSREQ_OURS) {
+        return;                                 // We acknowledge this one ourselves
+    }
+    busExpectAck(bus, now);
+}
+
+// ---------------------------------------------------------------------------
+// BUSSENT
+// ---------------------------------------------------------------------------
+// Call for every frame we hand to the UART of a unit. Its end on the line is
+// estimated from its length; the unit has to acknowledge it, and reply if
+// it is a request.
+//
+// INPUTS:
+//    unit           Unit the frame goes to
+//    command        Command byte of the frame
+//    length         Number of data bytes
+//    wireSize       Bytes on the wire (start to stop sequence)
+// ---------------------------------------------------------------------------
+
+void busSent(uint8_t unit, uint8_t command, uint8_t length, uint16_t wireSize) {
+    BusUnit& bus = busUnits[unit];
+    unsigned long end = millis() + (wireSize * 10000UL) / ZEHNDER_BAUDRATE;
+    busExpectAck(bus, end);
+    if (length == 0) {
+        busRequest(bus, command, BUSREQ_OURS, end);
+    }
+}
+
+// Call for every ACK (07 F3) on the line of a unit
+void busAck(uint8_t unit) {
+    busUnits[unit].ackWaiting = false;
+}
+
+// Appends " key=value"
+static void busAppend(PayloadWriter& msg, const __FlashStringHelper* key, long value) {
+    msg.append(' ');
+    msg.append(key);
+    msg.append('=');
+    msg.appendInt(value);
+}
+
+// ---------------------------------------------------------------------------
+// BUSREPORT
+// ---------------------------------------------------------------------------
+// Queues the next line of the report in progress: the summary of a unit,
+// then its request commands that saw any traffic. Once a unit is done, its
+// rows are dropped: the next interval starts from scratch.
+// ---------------------------------------------------------------------------
+
+static void busReport() {
+    BusUnit& bus = busUnits[busReportUnit];
+    PayloadWriter msg(mqttPayload, sizeof(mqttPayload));
+    if (busReportLine == 0) {
+        UartStats uart = zehnderUarts[busReportUnit]->stats();
+        uint32_t bytes = uart.bytes + uart.sent;
+        uint32_t capacity = (uint32_t)(busInterval / 100) * (ZEHNDER_BAUDRATE / 100);  // Bytes the line could carry (10 bits per byte)
+        msg.append(F("command=02"));
+        busAppend(msg, F("load"), capacity ? (long)((bytes - bus.lineBytes) * 100 / capacity) : 0);
+        busAppend(msg, F("requests"), bus.counters.requests);
+        busAppend(msg, F("replies"), bus.counters.replies);
+        busAppend(msg, F("timeouts"), bus.counters.timeouts);
+        busAppend(msg, F("noack"), bus.counters.noAcks);
+        busAppend(msg, F("unmatched"), bus.counters.unmatched);
+        busAppend(msg, F("unsolicited"), bus.counters.unsolicited);
+        bus.lineBytes = bytes;
+    } else {
+        BusCommand& row = bus.commands[busReportLine - 1];
+        msg.append(F("command=03 request="));
+        msg.appendHex(row.command);
+        busAppend(msg, F("replies"), row.replies);
+        busAppend(msg, F("timeouts"), row.timeouts);
+        busAppend(msg, F("avg"), row.replies ? (long)(row.sumLatency / row.replies) : 0);
+        busAppend(msg, F("max"), row.maxLatency);
+        msg.append(F(" hist="));
+        for (uint8_t i = 0; i < BUS_BUCKETS; i++) {
+            if (i > 0) msg.append('/');
+            msg.appendInt(row.histogram[i]);
+        }
+    }
+    mqttPublishSystem(msg.c_str(), msg.length(), busReportUnit);
+
+    // Next command with replies or timeouts, else the next unit
+    do {
+        busReportLine++;
+    } while (busReportLine <= bus.commandCount && bus.commands[busReportLine - 1].replies == 0 &&
+             bus.commands[busReportLine - 1].timeouts == 0);
+    if (busReportLine > bus.commandCount) {
+        // Reported: the next interval starts without rows, so commands that
+        // show up later get one (busCommand() adds them again as needed)
+        bus.commandCount = 0;
+        busReportLine = 0;
+        busReportUnit++;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// BUSMAINTAIN
+// ---------------------------------------------------------------------------
+// Call from loop(): expires missing ACKs and unanswered requests, and every
+// BUS_INTERVAL writes the report, one line per call.
+// ---------------------------------------------------------------------------
+
+void busMaintain() {
+    unsigned long now = millis();
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        BusUnit& bus = busUnits[unit];
+        if (bus.ackWaiting && (long)(now - bus.ackSince) >= BUS_ACKTIMEOUT) {
+            bus.counters.noAcks++;
+            bus.ackWaiting = false;
+        }
+        for (uint8_t i = 0; i < BUS_PENDING; i++) {
+            BusRequest& request = bus.pending[i];
+            if ((request.flags & BUSREQ_USED) && (long)(now - request.time) >= BUS_TIMEOUT) {
+                busTimeout(bus, request);
+            }
+        }
+    }
+
+    if (busReportUnit < ZEHNDER_UNITS) {
+        busReport();
+    } else if (now - busLastReport >= BUS_INTERVAL) {
+        busInterval = now - busLastReport;
+        busLastReport = now;
+        busReportUnit = 0;
+        busReportLine = 0;
+    }
+}
+
+const BusStats& busStats(uint8_t unit) {
+    return busUnits[unit].counters;
+}
+
+#endif
@@ -0,0 +1,94 @@
+/* =============================================================================
+   Bus.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_BUS_H
+#define __COMFOAIR_ARDUINO_BUS_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Request/response correlation
+   --------------------------------------------------------------------------
+   Traffic on a ComfoAir line comes in exchanges: a request (a frame
+   without data), the ACK of the receiver (07 F3), then the reply with the
+   request command + 1, acknowledged in turn. The correlator follows these
+   exchanges for every unit:
+
+   - Requests seen on the line, and the ones we send ourselves (poller.cpp),
+     are remembered with a timestamp, at most BUS_PENDING per unit.
+   - A frame with command + 1 of a remembered request is its reply. The
+     time from the end of the request to the end of the reply goes into a
+     histogram of that request command; a request without a reply within
+     BUS_TIMEOUT ms counts as a timeout.
+   - After every frame (except the replies to our own requests, which we
+     acknowledge ourselves) an ACK must follow within BUS_ACKTIMEOUT ms,
+     before the next frame. If not, it counts as a missing ACK.
+
+   Frames are timestamped when the decoder completes them; our own requests
+   when they are handed to the UART, plus their time on the wire. A loop()
+   that is slow to read the receive ring (see loop= in the status line)
+   therefore adds to the measured times.
+
+   Every BUS_INTERVAL, each unit reports on its system topic: one summary
+   line, then a line per request command seen in that interval:
+
+      command=02 load=14 requests=60 replies=59 timeouts=1 noack=0 unmatched=0 unsolicited=2
+      command=03 request=D1 replies=6 timeouts=0 avg=31 max=44 hist=0/0/0/6/0/0/0/0
+
+   load        Share of the line capacity used in this interval (%; both
+               directions, as far as they are seen on our RX line plus
+               what we sent)
+   requests    Requests seen or sent (from boot)
+   replies     Requests that were answered in time (from boot)
+   timeouts    Requests that were not answered in time (from boot)
+   noack       Frames without an ACK (from boot)
+   unmatched   Replies to a request command seen before, but with no such
+               request pending: late, or the request was missed (from boot)
+   unsolicited Frames with data that answer no request command seen on the
+               line, e.g. writes or status messages (from boot)
+
+   request     Request command; the other keys count this interval only
+   avg, max    Response time in ms
+   hist        Number of replies per response time: below 8, 16, 32, 64,
+               128, 256 and 512 ms, then the rest (BUS_BUCKETS buckets of
+               doubling width starting at BUS_BUCKETBASE ms)
+
+   The lines of request commands are reset after every report. Only the
+   first BUS_COMMANDS request commands of an interval get a line of their
+   own; all requests are counted in the summary.
+   -------------------------------------------------------------------------- */
+
+#define BUS_ENABLE                              // Comment out to skip request/response correlation
+#define BUS_INTERVAL 300000                     // Report every this many ms
+#define BUS_PENDING 4                           // Requests tracked at a time, per unit
+#define BUS_COMMANDS 8                          // Request commands with a histogram, per unit
+#define BUS_BUCKETS 8                           // Histogram buckets
+#define BUS_BUCKETBASE 8                        // Upper bound of the first bucket (ms)
+#define BUS_TIMEOUT 500                         // Give up on a reply after this many ms
+#define BUS_ACKTIMEOUT 100                      // Expect an ACK within this many ms of a frame
+
+// Correlator counters (from boot)
+struct BusStats {
+    uint32_t requests;                          // Requests seen or sent
+    uint32_t replies;                           // Replies matched to a request
+    uint16_t timeouts;                          // Requests without a reply in time
+    uint16_t noAcks;                            // Frames not followed by an ACK
+    uint16_t unmatched;                         // Replies without a pending request
+    uint16_t unsolicited;                       // Frames with data that are no reply
+    uint16_t maxLatency;                        // Slowest response seen (ms)
+};
+
+#ifdef BUS_ENABLE
+
+// Function declarations
+void busFrame(uint8_t unit, uint8_t command, uint8_t length);
+void busSent(uint8_t unit, uint8_t command, uint8_t length, uint16_t wireSize);
+void busAck(uint8_t unit);
+void busMaintain();
+const BusStats& busStats(uint8_t unit);
+
+#endif
+
+#endif
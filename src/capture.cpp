@@ -0,0 +1,126 @@
+/* =============================================================================
+   Capture.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "capture.h"
+
+#ifdef CAPTURE_ENABLE
+
+#include "mqtt.h"
+#include "queue.h"
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+static byte captureChunk[CAPTURE_CHUNKSIZE];
+static uint8_t captureLength = 0;               // Bytes used in captureChunk (0 = no chunk open)
+static uint16_t captureSequence = 0;
+static unsigned long captureStart;              // millis() of the chunk's first record
+static unsigned long captureLast;               // millis() of the previous record
+static CaptureStats captureCounters;
+
+// Complete chunks waiting for room in the MQTT queue
+static byte captureBacklogBuffer[CAPTURE_BACKLOG];
+static MessageQueue captureBacklog(captureBacklogBuffer, CAPTURE_BACKLOG, QUEUE_DROP_OLDEST);
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// Hands waiting chunks to MQTT, oldest first, as long as they fit
+static void captureSend() {
+    uint8_t topic;
+    const byte* chunk;
+    uint16_t length;
+    while (captureBacklog.peek(topic, chunk, length) && mqttPublishCapture(chunk, length)) {
+        captureBacklog.pop();
+        captureCounters.chunks++;
+    }
+}
+
+// Moves the open chunk, if any, to the backlog and sends what fits
+static void captureFlush() {
+    if (captureLength == 0) {
+        return;
+    }
+    captureBacklog.push(0, captureChunk, captureLength);
+    captureCounters.dropped = captureBacklog.stats().dropped;
+    captureLength = 0;
+    captureSequence++;
+    captureSend();
+}
+
+static void captureOpen(unsigned long now) {
+    captureChunk[0] = 'C';
+    captureChunk[1] = 'A';
+    captureChunk[2] = CAPTURE_VERSION;
+    captureChunk[3] = captureSequence & 0xFF;
+    captureChunk[4] = captureSequence >> 8;
+    for (uint8_t i = 0; i < 4; i++) {
+        captureChunk[5 + i] = (now >> (8 * i)) & 0xFF;
+    }
+    captureLength = CAPTURE_HEADERSIZE;
+    captureStart = now;
+    captureLast = now;
+}
+
+// ---------------------------------------------------------------------------
+// CAPTUREBYTES
+// ---------------------------------------------------------------------------
+// Records bytes just read from the Zehnder port. Runs of bytes are split
+// over as many records (and chunks) as needed.
+// ---------------------------------------------------------------------------
+
+void captureBytes(const byte* data, uint16_t length) {
+    unsigned long now = millis();
+    captureCounters.bytes += length;
+    while (length > 0) {
+        if (captureLength == 0) {
+            captureOpen(now);
+        }
+        // Varint of the delta; 3 bytes cover 35 minutes
+        byte delta[5];
+        uint8_t deltaSize = 0;
+        unsigned long value = now - captureLast;
+        do {
+            delta[deltaSize] = value & 0x7F;
+            value >>= 7;
+            if (value) delta[deltaSize] |= 0x80;
+            deltaSize++;
+        } while (value);
+
+        uint8_t room = CAPTURE_CHUNKSIZE - captureLength;
+        if (room < deltaSize + 2) {
+            captureFlush();
+            continue;
+        }
+        uint8_t count = room - deltaSize - 1;
+        if (count > length) count = length;
+
+        memcpy(captureChunk + captureLength, delta, deltaSize);
+        captureLength += deltaSize;
+        captureChunk[captureLength++] = count;
+        memcpy(captureChunk + captureLength, data, count);
+        captureLength += count;
+        captureLast = now;
+        data += count;
+        length -= count;
+    }
+}
+
+// Call from loop(): sends waiting chunks once there is room, and a partial
+// chunk once it is CAPTURE_FLUSH old
+void captureMaintain() {
+    captureSend();
+    if (captureLength > 0 && millis() - captureStart >= CAPTURE_FLUSH) {
+        captureFlush();
+    }
+}
+
+const CaptureStats& captureStats() {
+    return captureCounters;
+}
+
+#endif
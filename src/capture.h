@@ -0,0 +1,65 @@
+/* =============================================================================
+   Capture.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_CAPTURE_H
+#define __COMFOAIR_ARDUINO_CAPTURE_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Raw bus capture
+   --------------------------------------------------------------------------
+   Every byte read from the Zehnder port is recorded, with a timestamp, and
+   streamed to MQTTPUBTOPIC_CAPTURE in binary chunks of at most
+   CAPTURE_CHUNKSIZE bytes. A chunk is sent when it is full, or
+   CAPTURE_FLUSH ms after its first record. All numbers are little endian.
+
+   Chunk:
+      'C' 'A'        Magic
+      version        CAPTURE_VERSION
+      sequence       uint16, +1 per chunk (a gap means chunks were lost)
+      start          uint32, millis() of the first record
+      records...
+
+   Record:
+      delta          ms since the previous record (first: since "start"),
+                     as a varint: 7 bits per byte, low bits first, high bit
+                     set on all but the last byte
+      length         uint8, 1..255
+      bytes          The bytes exactly as received
+
+   Timestamps are taken when the main loop reads the bytes from the receive
+   ring, so bytes arriving while the loop is busy share one record.
+   Capture chunks never fill more than half of the outbound MQTT queue, so
+   they do not push measurements out. Complete chunks that do not fit wait
+   in a backlog of CAPTURE_BACKLOG bytes (a queue of its own) until the
+   MQTT queue has room, e.g. while the broker is not connected yet. Only
+   when the backlog is full is its oldest chunk dropped (and shows up as a
+   sequence gap).
+
+   A capture file, as written and replayed by the host build, is a series
+   of chunks, each preceded by its length as a uint16.
+   -------------------------------------------------------------------------- */
+
+//#define CAPTURE_ENABLE                        // Stream all received bytes (or build with -D CAPTURE_ENABLE)
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADERSIZE 9                    // Magic, version, sequence, start
+#define CAPTURE_CHUNKSIZE 128                   // Bytes per chunk, header included
+#define CAPTURE_FLUSH 1000                      // Send a partial chunk after this many ms
+#define CAPTURE_BACKLOG 1024                    // Bytes of RAM for chunks waiting for MQTT queue space
+
+// Capture counters
+struct CaptureStats {
+    uint32_t bytes;                             // Bytes captured
+    uint16_t chunks;                            // Chunks queued for MQTT
+    uint16_t dropped;                           // Chunks dropped because the backlog was full
+};
+
+// Function declarations
+void captureBytes(const byte* data, uint16_t length);
+void captureMaintain();
+const CaptureStats& captureStats();
+
+#endif
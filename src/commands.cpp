@@ -0,0 +1,212 @@
+/* =============================================================================
+   Commands.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "commands.h"
+
+/*=============================================================================
+   OUTPUT KEYS
+  ============================================================================= */
+
+static const char key_fan_intake_pct[] PROGMEM = "fan_intake_pct";
+static const char key_fan_exhaust_pct[] PROGMEM = "fan_exhaust_pct";
+static const char key_fan_intake_rpm[] PROGMEM = "fan_intake_rpm";
+static const char key_fan_exhaust_rpm[] PROGMEM = "fan_exhaust_rpm";
+static const char key_fan_level[] PROGMEM = "fan_level";
+static const char key_fan_intake_on[] PROGMEM = "fan_intake_on";
+static const char key_bypass_pct[] PROGMEM = "bypass_pct";
+static const char key_preheat[] PROGMEM = "preheat";
+static const char key_bypass_motor[] PROGMEM = "bypass_motor";
+static const char key_preheat_motor[] PROGMEM = "preheat_motor";
+static const char key_bypass_factor[] PROGMEM = "bypass_factor";
+static const char key_bypass_level[] PROGMEM = "bypass_level";
+static const char key_bypass_correction[] PROGMEM = "bypass_correction";
+static const char key_summer_mode[] PROGMEM = "summer_mode";
+static const char key_t_comfort[] PROGMEM = "t_comfort";
+static const char key_t1_intake[] PROGMEM = "t1_intake";
+static const char key_t2_tohome[] PROGMEM = "t2_tohome";
+static const char key_t3_fromhome[] PROGMEM = "t3_fromhome";
+static const char key_t4_exhaust[] PROGMEM = "t4_exhaust";
+static const char key_error_a[] PROGMEM = "error_a";
+static const char key_error_e[] PROGMEM = "error_e";
+static const char key_filter_full[] PROGMEM = "filter_full";
+static const char key_hours_away[] PROGMEM = "hours_away";
+static const char key_hours_low[] PROGMEM = "hours_low";
+static const char key_hours_mid[] PROGMEM = "hours_mid";
+static const char key_hours_high[] PROGMEM = "hours_high";
+static const char key_hours_frost[] PROGMEM = "hours_frost";
+static const char key_hours_preheat[] PROGMEM = "hours_preheat";
+static const char key_hours_bypass[] PROGMEM = "hours_bypass";
+static const char key_hours_filter[] PROGMEM = "hours_filter";
+
+/*=============================================================================
+   FIELD TABLE (sorted on command!)
+  ============================================================================= */
+
+const CAField caFields[] PROGMEM = {
+    // 0x0C - Ventilator status (reply to 0x0B)
+    //       Byte[1]   - Intake fan speed (%)
+    //       Byte[2]   - Exhaust fan speed (%)
+    //       Byte[3-4] - Intake fan speed (1875000/value rpm)
+    //       Byte[5-6] - Exhaust fan speed (1875000/value rpm)
+    { 0x0C, 0, 1, CASCALE_RAW,  0, key_fan_intake_pct },
+    { 0x0C, 1, 1, CASCALE_RAW,  0, key_fan_exhaust_pct },
+    { 0x0C, 2, 2, CASCALE_RPM,  10, key_fan_intake_rpm },
+    { 0x0C, 4, 2, CASCALE_RPM,  10, key_fan_exhaust_rpm },
+
+    // 0x0E - Valve status (reply to 0x0D)
+    //       Byte[1]   - Bypass (%, 0xFF = undefined)
+    //       Byte[2]   - Preheating (0 = closed, 1 = open, 2 = unknown)
+    //       Byte[3]   - Bypass motor current
+    //       Byte[4]   - Preheating motor current
+    { 0x0E, 0, 1, CASCALE_RAW,  0, key_bypass_pct },
+    { 0x0E, 1, 1, CASCALE_RAW,  0, key_preheat },
+    { 0x0E, 2, 1, CASCALE_RAW,  0, key_bypass_motor },
+    { 0x0E, 3, 1, CASCALE_RAW,  0, key_preheat_motor },
+
+    // 0x12 - Temperature status (reply to 0x11)
+    //       Byte[1]   - Komfort Temperatur (°C*)
+    //       Byte[2]   - T1 / Außenluft (°C*)
+    //       Byte[3]   - T2 / Zuluft (°C*)
+    //       Byte[4]   - T3 / Abluft (°C*)
+    //       Byte[5]   - T4 / Fortluft (°C*)
+    { 0x12, 0, 1, CASCALE_TEMP, 0, key_t_comfort },
+    { 0x12, 1, 1, CASCALE_TEMP, 0, key_t1_intake },
+    { 0x12, 2, 1, CASCALE_TEMP, 0, key_t2_tohome },
+    { 0x12, 3, 1, CASCALE_TEMP, 0, key_t3_fromhome },
+    { 0x12, 4, 1, CASCALE_TEMP, 0, key_t4_exhaust },
+
+    // 0xCE - Ventilation levels (reply to 0xCD)
+    //       Byte[7]   - Current exhaust fan speed (%)
+    //       Byte[8]   - Current intake fan speed (%)
+    //       Byte[9]   - Current level (1 = away, 2 = low, 3 = mid, 4 = high)
+    //       Byte[10]  - Intake fan active (1 = yes)
+    { 0xCE, 6, 1, CASCALE_RAW,  0, key_fan_exhaust_pct },
+    { 0xCE, 7, 1, CASCALE_RAW,  0, key_fan_intake_pct },
+    { 0xCE, 8, 1, CASCALE_RAW,  0, key_fan_level },
+    { 0xCE, 9, 1, CASCALE_RAW,  0, key_fan_intake_on },
+
+    // 0xD2 - ReadTemperatures Extended (reply to 0xD1)
+    //  - Provides details of the temperature sensors in the unit
+    //  - Example raw string:
+    //    07F0 00D2 09504C4D54540F282828A0070F07F3 07F0
+    //       Byte[1]   - Komfort Temperatur (°C*)
+    //       Byte[2]   - T1 / Außenluft (°C*)
+    //       Byte[3]   - T2 / Zuluft (°C*)
+    //       Byte[4]   - T3 / Abluft (°C*)
+    //       Byte[5]   - T4 / Fortluft (°C*)
+    { 0xD2, 0, 1, CASCALE_TEMP, 0, key_t_comfort },
+    { 0xD2, 1, 1, CASCALE_TEMP, 0, key_t1_intake },
+    { 0xD2, 2, 1, CASCALE_TEMP, 0, key_t2_tohome },
+    { 0xD2, 3, 1, CASCALE_TEMP, 0, key_t3_fromhome },
+    { 0xD2, 4, 1, CASCALE_TEMP, 0, key_t4_exhaust },
+
+    // 0xDA - Errors (reply to 0xD9)
+    //       Byte[1]   - Current error A
+    //       Byte[2]   - Current error E
+    //       Byte[9]   - Filter (0 = OK, 1 = full)
+    { 0xDA, 0, 1, CASCALE_RAW,  0, key_error_a },
+    { 0xDA, 1, 1, CASCALE_RAW,  0, key_error_e },
+    { 0xDA, 8, 1, CASCALE_RAW,  0, key_filter_full },
+
+    // 0xDE - Operating hours (reply to 0xDD)
+    //       Byte[1-3]   - Level away
+    //       Byte[4-6]   - Level low
+    //       Byte[7-9]   - Level mid
+    //       Byte[10-11] - Frost protection
+    //       Byte[12-13] - Preheating
+    //       Byte[14-15] - Bypass open
+    //       Byte[16-17] - Filter
+    //       Byte[18-20] - Level high
+    { 0xDE, 0, 3, CASCALE_RAW,  0, key_hours_away },
+    { 0xDE, 3, 3, CASCALE_RAW,  0, key_hours_low },
+    { 0xDE, 6, 3, CASCALE_RAW,  0, key_hours_mid },
+    { 0xDE, 9, 2, CASCALE_RAW,  0, key_hours_frost },
+    { 0xDE, 11, 2, CASCALE_RAW,  0, key_hours_preheat },
+    { 0xDE, 13, 2, CASCALE_RAW,  0, key_hours_bypass },
+    { 0xDE, 15, 2, CASCALE_RAW,  0, key_hours_filter },
+    { 0xDE, 17, 3, CASCALE_RAW,  0, key_hours_high },
+
+    // 0xE0 - Bypass control status (reply to 0xDF)
+    //       Byte[3]   - Bypass factor
+    //       Byte[4]   - Bypass level
+    //       Byte[5]   - Bypass correction
+    //       Byte[7]   - Summer mode (1 = yes)
+    { 0xE0, 2, 1, CASCALE_RAW,  0, key_bypass_factor },
+    { 0xE0, 3, 1, CASCALE_RAW,  0, key_bypass_level },
+    { 0xE0, 4, 1, CASCALE_RAW,  0, key_bypass_correction },
+    { 0xE0, 6, 1, CASCALE_RAW,  0, key_summer_mode },
+};
+
+// The row count sizes bitmaps, topic ids and the EEPROM record (persist.cpp);
+// the order is checked by the host build (program --check)
+static_assert(sizeof(caFields) / sizeof(caFields[0]) == CAFIELD_COUNT, "CAFIELD_COUNT must match the rows of caFields[]");
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// ---------------------------------------------------------------------------
+// CAFINDCOMMAND
+// ---------------------------------------------------------------------------
+// Binary search for the first field of a command in caFields[].
+//
+// INPUTS:
+//    command        Command byte to look up
+// OUTPUTS:
+//    uint8_t        Index of the first field, or CAFIELD_NONE if unknown
+// ---------------------------------------------------------------------------
+
+uint8_t caFindCommand(uint8_t command) {
+    uint8_t lo = 0;
+    uint8_t hi = CAFIELD_COUNT;
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        if (pgm_read_byte(&caFields[mid].command) < command) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if ((lo < CAFIELD_COUNT) && (pgm_read_byte(&caFields[lo].command) == command)) {
+        return lo;
+    }
+    return CAFIELD_NONE;
+}
+
+// Copies a table row from flash
+void caReadField(uint8_t index, CAField& field) {
+    memcpy_P(&field, &caFields[index], sizeof(CAField));
+}
+
+// ---------------------------------------------------------------------------
+// CAFIELDVALUE
+// ---------------------------------------------------------------------------
+// Reads the raw (unscaled) value of a field from a frame's data block. The
+// caller makes sure the field lies within the data block.
+// ---------------------------------------------------------------------------
+
+long caFieldValue(const CAField& field, const byte* data) {
+    unsigned long value = 0;
+    for (uint8_t i = 0; i < field.width; i++) {
+        value = (value << 8) | data[field.offset + i];
+    }
+    return (long)value;
+}
+
+bool caAppendKey(PayloadWriter& payload, const CAField& field) {
+    return payload.append(reinterpret_cast<const __FlashStringHelper*>(field.key));
+}
+
+// Prints a raw field value, applying the field's scaling
+bool caAppendValue(PayloadWriter& payload, const CAField& field, long value) {
+    switch (field.scale) {
+        case CASCALE_TEMP:
+            return payload.appendFixed(caTemperature((uint8_t)value), CATEMP_DECIMALS);
+        case CASCALE_RPM:
+            return payload.appendInt((value > 0) ? (1875000L / value) : 0);
+        default:
+            return payload.appendInt(value);
+    }
+}
@@ -0,0 +1,67 @@
+/* =============================================================================
+   Commands.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_COMMANDS_H
+#define __COMFOAIR_ARDUINO_COMMANDS_H
+
+#include <Arduino.h>
+#include "payload.h"
+
+/* --------------------------------------------------------------------------
+   ComfoAir command registry
+   --------------------------------------------------------------------------
+   One PROGMEM table describes every field we decode: which command it
+   belongs to, where it sits in the data block, how wide it is, how to scale
+   it, how far it may drift before it is republished and under which key it
+   is published. The table is sorted on command so the fields of a command
+   can be found with a binary search; supporting a new command only requires
+   adding rows to caFields[] in commands.cpp.
+   -------------------------------------------------------------------------- */
+
+#define CAFIELD_COUNT 37                        // Number of rows in caFields[]
+#define CAFIELD_NONE 0xFF                       // "No field" marker
+#define CAFIELD_KEYSIZE 20                      // Longest output key, NUL included
+
+// Value scaling
+enum CAFieldScale : uint8_t {
+    CASCALE_RAW = 0,                            // Plain unsigned integer
+    CASCALE_TEMP,                               // Zehnder temperature: (TEMP + 20) * 2
+    CASCALE_RPM                                 // Fan speed: 1875000 / value
+};
+
+// Field layout
+struct CAField {
+    uint8_t command;                            // Command byte (low byte of the command)
+    uint8_t offset;                             // Offset in the data block (0 = Byte[1])
+    uint8_t width;                              // Width in bytes (big endian, 1..4)
+    uint8_t scale;                              // CAFieldScale
+    uint8_t deadband;                           // Publish only changes larger than this (raw units)
+    const char* key;                            // Output key (PROGMEM)
+};
+
+extern const CAField caFields[] PROGMEM;         // CAFIELD_COUNT rows (checked in commands.cpp)
+
+// Zehnder temperatures are sent as (TEMP + 20) * 2, i.e. in half degrees.
+// We keep them as fixed point all the way through: hundredths of a degree
+// for output, tenths of a degree for settings received over MQTT.
+#define CATEMP_DECIMALS 2                       // Decimals of caTemperature()
+
+constexpr int16_t caTemperature(uint8_t raw) {
+    return ((int16_t)raw - 40) * 50;
+}
+
+// Inverse for settings, rounded to the nearest half degree
+constexpr uint8_t caTemperatureRaw(int16_t tenths) {
+    return (uint8_t)((tenths + 200 + 2) / 5);
+}
+
+// Function declarations
+uint8_t caFindCommand(uint8_t command);
+void caReadField(uint8_t index, CAField& field);
+long caFieldValue(const CAField& field, const byte* data);
+bool caAppendKey(PayloadWriter& payload, const CAField& field);
+bool caAppendValue(PayloadWriter& payload, const CAField& field, long value);
+
+#endif
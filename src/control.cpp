@@ -0,0 +1,315 @@
+/* =============================================================================
+   Control.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "control.h"
+#include "commands.h"
+#include "decoder.h"
+#include "payload.h"
+#include "uart.h"
+#include "mqtt.h"
+#include "bus.h"
+#include "log.h"
+
+/*=============================================================================
+   CONTROL TABLE
+  ============================================================================= */
+
+// Settings that can be written. Limits are in the unit of the key: raw
+// values, or tenths of a degree for temperatures.
+struct ControlKey {
+    const char* key;                            // MQTT key (PROGMEM)
+    uint8_t command;                            // ComfoAir write command
+    uint8_t scale;                              // CAFieldScale of the single data byte
+    int16_t minimum;
+    int16_t maximum;
+};
+
+static const char ckey_fan[] PROGMEM = "fan";
+static const char ckey_comfort[] PROGMEM = "comfort";
+
+static const ControlKey controlKeys[CONTROL_KEYCOUNT] PROGMEM = {
+    // 0x99 - Set ventilation level
+    //       Byte[1]   - 0 = auto, 1 = away, 2 = low, 3 = mid, 4 = high
+    { ckey_fan,     0x99, CASCALE_RAW,  0,   4 },
+
+    // 0xD3 - Set comfort temperature
+    //       Byte[1]   - Temperature ((TEMP + 20) * 2)
+    { ckey_comfort, 0xD3, CASCALE_TEMP, 120, 280 }
+};
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+struct ControlWrite {
+    uint8_t key;                                // Row in controlKeys[]
+    uint8_t value;                              // Data byte to send
+    int16_t setting;                            // Value as received (for the confirmation)
+    unsigned long received;                     // millis() when the MQTT message arrived
+};
+
+// Write queue of one unit
+struct ControlUnit {
+    ControlWrite queue[CONTROL_QUEUE];
+    uint8_t head;                               // Oldest queued write
+    uint8_t count;
+    uint8_t tries;                              // Times the oldest write was sent
+    bool waiting;                               // Oldest write is on the line, ACK pending
+    unsigned long sent;                         // millis() of the last send
+    ControlStats counters;
+};
+
+static ControlUnit controlUnits[ZEHNDER_UNITS];
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// ---------------------------------------------------------------------------
+// CONTROLPARSEVALUE
+// ---------------------------------------------------------------------------
+// Parses a decimal number with at most one decimal ("21", "-3", "21.5") into
+// tenths. At most five digits before the decimal point; the caller checks
+// the range.
+//
+// OUTPUTS:
+//    bool           FALSE if the text is not such a number (no digits, more
+//                   than one decimal, anything else)
+// ---------------------------------------------------------------------------
+
+static bool controlParseValue(const byte* text, uint8_t length, long& tenths) {
+    bool negative = false;
+    bool fraction = false;
+    uint8_t digits = 0;                         // Digits before the decimal point
+    uint8_t decimals = 0;                       // Digits after it
+    long value = 0;
+    uint8_t i = 0;
+    if (i < length && text[i] == '-') {
+        negative = true;
+        i++;
+    }
+    for (; i < length; i++) {
+        if (text[i] == '.' && !fraction) {
+            fraction = true;
+        } else if (text[i] >= '0' && text[i] <= '9' && (fraction ? decimals == 0 : digits < 5)) {
+            value = value * 10 + (text[i] - '0');
+            if (fraction) decimals++;
+            else digits++;
+        } else {
+            return false;
+        }
+    }
+    if (digits + decimals == 0) return false;
+    if (decimals == 0) value *= 10;
+    tenths = negative ? -value : value;
+    return true;
+}
+
+// Confirms a write on the system topic: "command=99 fan=3 ack=1 tries=1 latency=38"
+static void controlReport(uint8_t unit, const ControlWrite& write, bool acked) {
+    const ControlUnit& control = controlUnits[unit];
+    PayloadWriter msg(mqttPayload, sizeof(mqttPayload));
+    ControlKey key;
+    memcpy_P(&key, &controlKeys[write.key], sizeof(key));
+
+    msg.append(F("command="));
+    msg.appendHex(key.command);
+    msg.append(' ');
+    msg.append((const __FlashStringHelper*)key.key);
+    msg.append('=');
+    if (key.scale == CASCALE_TEMP) {
+        msg.appendFixed(write.setting, 1);
+    } else {
+        msg.appendInt(write.setting / 10);
+    }
+    msg.append(acked ? F(" ack=1 tries=") : F(" ack=0 tries="));
+    msg.appendInt(control.tries);
+    msg.append(F(" latency="));
+    msg.appendInt(millis() - write.received);
+    mqttPublishSystem(msg.c_str(), msg.length(), unit);
+}
+
+// ---------------------------------------------------------------------------
+// CONTROLSETTING
+// ---------------------------------------------------------------------------
+// Validates a single key=value setting and queues its write frame. A write
+// for the same setting that has not gone out yet is simply updated, so a
+// burst of changes (a slider being dragged) costs one write.
+// ---------------------------------------------------------------------------
+
+static void controlSetting(uint8_t unit, const byte* key, uint8_t keyLength, const byte* value, uint8_t valueLength) {
+    ControlUnit& control = controlUnits[unit];
+    uint8_t row = 0;
+    for (; row < CONTROL_KEYCOUNT; row++) {
+        const char* name = (const char*)pgm_read_ptr(&controlKeys[row].key);
+        if (strlen_P(name) == keyLength && !memcmp_P(key, name, keyLength)) break;
+    }
+
+    ControlKey entry;
+    long setting;
+    if (row < CONTROL_KEYCOUNT) {
+        memcpy_P(&entry, &controlKeys[row], sizeof(entry));
+    }
+    if (row == CONTROL_KEYCOUNT || !controlParseValue(value, valueLength, setting)) {
+        LOG_WARNLN(F("Control: unknown key or bad value"));
+        control.counters.rejected++;
+        return;
+    }
+    if (entry.scale == CASCALE_RAW) {
+        if (setting % 10) setting = entry.maximum + 1L;  // Whole numbers only: out of range
+        else setting /= 10;
+    }
+    // Checked before narrowing: the limits fit an int16_t, the setting may not
+    if (setting < entry.minimum || setting > entry.maximum) {
+        LOG_WARNLN(F("Control: value out of range"));
+        control.counters.rejected++;
+        return;
+    }
+
+    ControlWrite write;
+    write.key = row;
+    write.setting = (int16_t)((entry.scale == CASCALE_RAW) ? setting * 10 : setting);
+    write.value = (entry.scale == CASCALE_TEMP) ? caTemperatureRaw((int16_t)setting) : (uint8_t)setting;
+    write.received = millis();
+
+    // Replace a queued write for the same setting, unless it is on the line
+    for (uint8_t i = (control.waiting || control.tries) ? 1 : 0; i < control.count; i++) {
+        ControlWrite& queued = control.queue[(control.head + i) % CONTROL_QUEUE];
+        if (queued.key == row) {
+            queued = write;
+            control.counters.received++;
+            return;
+        }
+    }
+    if (control.count == CONTROL_QUEUE) {
+        LOG_WARNLN(F("Control: queue full"));
+        control.counters.rejected++;
+        return;
+    }
+    control.queue[(control.head + control.count++) % CONTROL_QUEUE] = write;
+    control.counters.received++;
+}
+
+// ---------------------------------------------------------------------------
+// CONTROLMESSAGE
+// ---------------------------------------------------------------------------
+// Splits an inbound MQTT payload into key=value settings, separated by
+// spaces, commas or semicolons. Works on the payload in place.
+// ---------------------------------------------------------------------------
+
+void controlMessage(uint8_t unit, const byte* payload, unsigned int length) {
+    unsigned int pos = 0;
+    while (pos < length) {
+        while (pos < length && (payload[pos] == ' ' || payload[pos] == ',' || payload[pos] == ';')) pos++;
+        unsigned int start = pos, equals = 0;
+        while (pos < length && payload[pos] != ' ' && payload[pos] != ',' && payload[pos] != ';') {
+            if (payload[pos] == '=' && !equals) equals = pos;
+            pos++;
+        }
+        if (pos == start) break;
+        if (!equals || equals - start > 16 || pos - equals - 1 > 16) {
+            controlUnits[unit].counters.rejected++;
+            continue;
+        }
+        controlSetting(unit, payload + start, equals - start, payload + equals + 1, pos - equals - 1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// CONTROLSEND
+// ---------------------------------------------------------------------------
+// Called by the poller when the line is ours: sends the oldest queued write.
+//
+// OUTPUTS:
+//    bool           TRUE if a write was sent (the line is now busy)
+// ---------------------------------------------------------------------------
+
+bool controlSend(uint8_t unit) {
+    ControlUnit& control = controlUnits[unit];
+    if (control.count == 0 || control.waiting) {
+        return false;
+    }
+    const ControlWrite& write = control.queue[control.head];
+    byte frame[CADEC_WIRESIZE(1)];
+    uint8_t command = pgm_read_byte(&controlKeys[write.key].command);
+    uint16_t size = caEncodeFrame(command, &write.value, 1, frame);
+    if (!zehnderUarts[unit]->write(frame, size)) {
+        return false;
+    }
+#ifdef BUS_ENABLE
+    busSent(unit, command, 1, size);
+#endif
+    control.tries++;
+    control.waiting = true;
+    control.sent = millis();
+    return true;
+}
+
+// Drops the oldest write once it is acknowledged or given up on
+static void controlDone(ControlUnit& control) {
+    control.head = (control.head + 1) % CONTROL_QUEUE;
+    control.count--;
+    control.tries = 0;
+    control.waiting = false;
+}
+
+// ---------------------------------------------------------------------------
+// CONTROLACK
+// ---------------------------------------------------------------------------
+// Call for every acknowledge the decoder sees. Only an ACK that arrives
+// after our write has completely left the transmitter can be for us.
+// ---------------------------------------------------------------------------
+
+void controlAck(uint8_t unit) {
+    ControlUnit& control = controlUnits[unit];
+    if (!control.waiting || zehnderUarts[unit]->sending()) {
+        return;
+    }
+    const ControlWrite& write = control.queue[control.head];
+    unsigned long latency = millis() - write.received;
+    if (latency > control.counters.maxLatency) {
+        control.counters.maxLatency = (latency > 0xFFFF) ? 0xFFFF : latency;
+    }
+    control.counters.acked++;
+    controlReport(unit, write, true);
+    controlDone(control);
+}
+
+// TRUE while a write is on the line, waiting for its ACK
+bool controlBusy(uint8_t unit) {
+    return controlUnits[unit].waiting;
+}
+
+// ---------------------------------------------------------------------------
+// CONTROLEXPIRE
+// ---------------------------------------------------------------------------
+// Repeats a write the unit did not acknowledge in time and reports it once
+// it failed CONTROL_TRIES times.
+// ---------------------------------------------------------------------------
+
+static void controlExpire(uint8_t unit) {
+    ControlUnit& control = controlUnits[unit];
+    if (!control.waiting || millis() - control.sent < CONTROL_ACKTIMEOUT) {
+        return;
+    }
+    control.waiting = false;                    // Poller sends it again at the next gap
+    if (control.tries >= CONTROL_TRIES) {
+        LOG_WARNLN(F("Control: no ACK from unit"));
+        control.counters.failed++;
+        controlReport(unit, control.queue[control.head], false);
+        controlDone(control);
+    }
+}
+
+// Call from loop(): checks the pending write of every unit
+void controlMaintain() {
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        controlExpire(unit);
+    }
+}
+
+const ControlStats& controlStats(uint8_t unit) {
+    return controlUnits[unit].counters;
+}
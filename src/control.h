@@ -0,0 +1,57 @@
+/* =============================================================================
+   Control.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_CONTROL_H
+#define __COMFOAIR_ARDUINO_CONTROL_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Unit control over MQTT
+   --------------------------------------------------------------------------
+   Messages on MQTTSUBTOPIC carry one or more key=value settings, e.g.
+
+      fan=3
+      comfort=21.5
+
+   Each setting is checked against the control table (controlKeys[] in
+   control.cpp) and queued as a ComfoAir write frame. The poller hands us the
+   line at the next quiet gap, ahead of any polling request. The unit
+   acknowledges a write with 07 F3; the result is confirmed on
+   MQTTPUBTOPIC_SYSTEM together with the time from MQTT arrival to ACK:
+
+      command=99 fan=3 ack=1 tries=1 latency=38
+
+   Unanswered writes are repeated up to CONTROL_TRIES times, so a setting
+   is either confirmed or reported as failed (ack=0) within
+   CONTROL_TRIES * CONTROL_ACKTIMEOUT ms of reaching the line.
+
+   With several units, each has its own board topic, write queue and
+   confirmations on its own system topic.
+   -------------------------------------------------------------------------- */
+
+#define CONTROL_KEYCOUNT 2                      // Number of rows in controlKeys[]
+#define CONTROL_QUEUE 4                         // Writes waiting for the line
+#define CONTROL_ACKTIMEOUT 250                  // Wait this many ms for the unit's ACK...
+#define CONTROL_TRIES 3                         // ... and send a write at most this often
+
+// Control counters
+struct ControlStats {
+    uint16_t received;                          // Settings accepted from MQTT
+    uint16_t rejected;                          // Unknown keys, bad values, queue full
+    uint16_t acked;                             // Writes acknowledged by the unit
+    uint16_t failed;                            // Writes given up on after CONTROL_TRIES
+    uint16_t maxLatency;                        // Slowest MQTT-to-ACK time (ms)
+};
+
+// Function declarations
+void controlMessage(uint8_t unit, const byte* payload, unsigned int length);
+bool controlSend(uint8_t unit);
+void controlAck(uint8_t unit);
+bool controlBusy(uint8_t unit);
+void controlMaintain();
+const ControlStats& controlStats(uint8_t unit);
+
+#endif
@@ -0,0 +1,175 @@
+/* =============================================================================
+   Decoder.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "decoder.h"
+
+ComfoAirDecoder::ComfoAirDecoder() {
+    memset(&_stats, 0, sizeof(_stats));
+    reset();
+}
+
+// ---------------------------------------------------------------------------
+// RESET
+// ---------------------------------------------------------------------------
+// Drops any partially received frame and starts hunting for a new one.
+// ---------------------------------------------------------------------------
+
+void ComfoAirDecoder::reset() {
+    _state = CADEC_HUNT;
+    _pos = 0;
+    _escape = false;
+    _sum = 0;
+    _checksum = 0;
+    _frame[0] = 0; _frame[1] = 0; _frame[2] = 0;
+}
+
+// ---------------------------------------------------------------------------
+// PUSH
+// ---------------------------------------------------------------------------
+// Feeds a single byte into the decoder. Every byte is looked at exactly once;
+// byte stuffing is removed and data bytes are written straight into the
+// frame buffer while the checksum is accumulated.
+//
+// INPUTS:
+//    c              The next byte read from the Zehnder port
+// OUTPUTS:
+//    uint8_t        CADEC_FRAME if this byte completed a frame, CADEC_ACK if
+//                   it completed an acknowledge, CADEC_NONE otherwise
+// ---------------------------------------------------------------------------
+
+uint8_t ComfoAirDecoder::push(byte c) {
+    // Remove byte stuffing between start and stop sequence
+    if ((_state >= CADEC_HEADER) && (_state <= CADEC_CHECKSUM)) {
+        if (_escape) {
+            _escape = false;
+            if (c != CADEC_ESCAPE) {
+                // A single 0x07 inside a frame: this is either a new start
+                // or a premature stop. Drop the frame and resynchronise.
+                _stats.framingErrors++;
+                _state = CADEC_START;
+                return push(c);
+            }
+            // Doubled 0x07: process a single 0x07 below
+        } else if (c == CADEC_ESCAPE) {
+            _escape = true;
+            return CADEC_NONE;
+        }
+    }
+
+    switch (_state) {
+        case CADEC_HUNT:
+            if (c == cacmd_StartCMD[0]) {
+                _state = CADEC_START;
+            } else {
+                _stats.noiseBytes++;
+            }
+            break;
+
+        case CADEC_START:
+            if (c == cacmd_StartCMD[1]) {
+                _state = CADEC_HEADER;
+                _pos = 0;
+                _sum = 0;
+            } else if (c == cacmd_AckCMD[1]) {
+                _state = CADEC_HUNT;
+                _stats.acks++;
+                return CADEC_ACK;
+            } else if (c != cacmd_StartCMD[0]) {
+                _stats.noiseBytes += 2;
+                _state = CADEC_HUNT;
+            }
+            break;
+
+        case CADEC_HEADER:
+            _frame[_pos++] = c;
+            _sum += c;
+            if (_pos == 2) {
+                _state = CADEC_LENGTH;
+            }
+            break;
+
+        case CADEC_LENGTH:
+            _frame[2] = c;
+            _sum += c;
+            _pos = 0;
+            _state = (c > 0) ? CADEC_DATA : CADEC_CHECKSUM;
+            break;
+
+        case CADEC_DATA:
+            _frame[CADEC_HEADERSIZE + _pos++] = c;
+            _sum += c;
+            if (_pos == _frame[2]) {
+                _state = CADEC_CHECKSUM;
+            }
+            break;
+
+        case CADEC_CHECKSUM:
+            _checksum = c;
+            _pos = 0;
+            _state = CADEC_STOP;
+            break;
+
+        case CADEC_STOP:
+            if (c == cacmd_StopCMD[_pos]) {
+                if (++_pos == 2) {
+                    // Complete frame received: verify checksum
+                    _state = CADEC_HUNT;
+                    if ((byte)(_sum + CADEC_CHECKSUMSEED) != _checksum) {
+                        _stats.checksumErrors++;
+                        return CADEC_NONE;
+                    }
+                    _stats.frames++;
+                    return CADEC_FRAME;
+                }
+            } else {
+                // Misaligned frame: drop it and resynchronise on this byte,
+                // which may itself be the start of the next frame.
+                _stats.framingErrors++;
+                _state = (_pos == 1) ? CADEC_START : CADEC_HUNT;
+                return push(c);
+            }
+            break;
+    }
+    return CADEC_NONE;
+}
+
+// ---------------------------------------------------------------------------
+// CAENCODEFRAME
+// ---------------------------------------------------------------------------
+// Builds a complete wire frame (start, stuffed body, checksum, stop); the
+// counterpart of the decoder for frames we send ourselves.
+//
+// INPUTS:
+//    command        Command byte (the high byte is always 0x00)
+//    data           Data bytes (may be NULL if length is 0)
+//    length         Number of data bytes
+//    out            Output buffer of at least CADEC_WIRESIZE(length) bytes
+// OUTPUTS:
+//    uint16_t       Number of bytes written to "out"
+// ---------------------------------------------------------------------------
+
+static inline void caEncodeByte(byte c, byte* out, uint16_t& n) {
+    out[n++] = c;
+    if (c == CADEC_ESCAPE) out[n++] = CADEC_ESCAPE;
+}
+
+uint16_t caEncodeFrame(uint8_t command, const byte* data, uint8_t length, byte* out) {
+    uint16_t n = 0;
+    byte sum = CADEC_CHECKSUMSEED + command + length;
+
+    out[n++] = cacmd_StartCMD[0];
+    out[n++] = cacmd_StartCMD[1];
+    caEncodeByte(0x00, out, n);
+    caEncodeByte(command, out, n);
+    caEncodeByte(length, out, n);
+    for (uint8_t i = 0; i < length; i++) {
+        caEncodeByte(data[i], out, n);
+        sum += data[i];
+    }
+    caEncodeByte(sum, out, n);
+    out[n++] = cacmd_StopCMD[0];
+    out[n++] = cacmd_StopCMD[1];
+    return n;
+}
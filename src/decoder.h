@@ -0,0 +1,100 @@
+/* =============================================================================
+   Decoder.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_DECODER_H
+#define __COMFOAIR_ARDUINO_DECODER_H
+
+#include <Arduino.h>
+#include "zehnder.h"
+
+/* --------------------------------------------------------------------------
+   Streaming ComfoAir frame decoder
+   --------------------------------------------------------------------------
+   Bytes are pushed one at a time; the decoder tracks where in a frame it is
+   and stores the command, length and data bytes exactly once in its own
+   frame buffer. As soon as the stop sequence arrives, push() reports that a
+   complete frame is available; an acknowledge (07 F3) between frames is
+   reported as well. The frame stays valid until the next byte is
+   pushed.
+
+   Frame layout on the wire:
+      07 F0 | CMD_HI CMD_LO | LEN | DATA[LEN] | CHECKSUM | 07 0F
+
+   Between start and stop, a 0x07 byte is sent twice (07 07) so it cannot be
+   mistaken for a start or stop sequence. The decoder removes this stuffing
+   while reading, so LEN always matches the number of stored data bytes.
+   The checksum is the sum of CMD, LEN and DATA bytes (unstuffed) plus 173,
+   truncated to a byte. Frames that fail either check are dropped and counted.
+   -------------------------------------------------------------------------- */
+
+#define CADEC_HEADERSIZE 3                      // CMD_HI, CMD_LO, LEN
+#define CADEC_BUFFERSIZE (CADEC_HEADERSIZE+255) // Header + maximum data length
+#define CADEC_ESCAPE 0x07                       // Byte that is doubled inside a frame
+#define CADEC_CHECKSUMSEED 173                  // Added to the sum of all frame bytes
+#define CADEC_WIRESIZE(len) (2*(CADEC_HEADERSIZE+(len)+1)+4) // Worst case wire size of a frame with "len" data bytes (all stuffed)
+#define CADEC_FRAMESIZE CADEC_WIRESIZE(255)     // Largest possible wire frame
+
+// Decoder states
+enum CADecoderState : uint8_t {
+    CADEC_HUNT = 0,                             // Looking for the first start byte (0x07)
+    CADEC_START,                                // Expecting second start byte (0xF0)
+    CADEC_HEADER,                               // Reading the two command bytes
+    CADEC_LENGTH,                               // Reading the data length byte
+    CADEC_DATA,                                 // Reading data bytes
+    CADEC_CHECKSUM,                             // Reading the checksum byte
+    CADEC_STOP                                  // Expecting the stop sequence (0x07 0x0F)
+};
+
+// Result of pushing a byte
+enum CADecoderEvent : uint8_t {
+    CADEC_NONE = 0,                             // Nothing completed yet
+    CADEC_FRAME,                                // A valid frame is available
+    CADEC_ACK                                   // An acknowledge (07 F3) was received
+};
+
+// Decoder counters
+struct CADecoderStats {
+    uint32_t frames;                            // Valid frames decoded
+    uint16_t checksumErrors;                    // Frames dropped due to checksum mismatch
+    uint16_t framingErrors;                     // Frames dropped due to misplaced start/stop/escape
+    uint32_t noiseBytes;                        // Bytes skipped while hunting for a frame start
+    uint32_t acks;                              // Acknowledges (07 F3) seen between frames
+};
+
+class ComfoAirDecoder {
+    public:
+        ComfoAirDecoder();
+
+        void reset();
+        uint8_t push(byte c);
+
+        // Accessors for the last completed frame
+        uint16_t command() const        { return ((uint16_t)_frame[0] << 8) | _frame[1]; }
+        uint8_t commandByte() const     { return _frame[1]; }
+        uint8_t dataLength() const      { return _frame[2]; }
+        const byte* data() const        { return _frame + CADEC_HEADERSIZE; }
+        const byte* buffer() const      { return _frame; }
+        uint16_t size() const           { return CADEC_HEADERSIZE + _frame[2]; }
+        byte checksum() const           { return _checksum; }
+
+        // TRUE while no frame is being received
+        bool idle() const               { return _state == CADEC_HUNT; }
+
+        const CADecoderStats& stats() const { return _stats; }
+
+    private:
+        uint8_t _state;                         // Current CADecoderState
+        uint8_t _pos;                           // Position within the current state
+        bool _escape;                           // Previous byte inside the frame was 0x07
+        byte _sum;                              // Running checksum over CMD, LEN and DATA
+        byte _checksum;                         // Received checksum byte
+        CADecoderStats _stats;
+        byte _frame[CADEC_BUFFERSIZE];          // CMD_HI, CMD_LO, LEN, DATA...
+};
+
+// Function declarations
+uint16_t caEncodeFrame(uint8_t command, const byte* data, uint8_t length, byte* out);
+
+#endif
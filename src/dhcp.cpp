@@ -0,0 +1,180 @@
+/* =============================================================================
+   Dhcp.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "dhcp.h"
+
+#define DHCPC_FIXEDSIZE 236                      // BOOTP header up to the options
+#define DHCPC_CIADDROFFSET 12                    // Client address within the header
+#define DHCPC_CHADDROFFSET 28                    // Client hardware address within the header
+
+static const byte dhcpCookie[] = { 0x63, 0x82, 0x53, 0x63 };
+
+// ---------------------------------------------------------------------------
+// DHCPCLIENT::BEGIN
+// ---------------------------------------------------------------------------
+// Opens the client port, closing it first if it is still open from an
+// earlier bring-up, so starting over does not leave a socket behind. The
+// Ethernet chip must already be initialised (an address of 0.0.0.0 is fine
+// for broadcasting).
+// ---------------------------------------------------------------------------
+
+void DhcpClient::begin(const byte* mac) {
+    _mac = mac;
+    _xid = ((uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5]) ^ micros();
+    _udp.stop();
+    _udp.begin(DHCPC_CLIENTPORT);
+}
+
+bool DhcpClient::sendDiscover() {
+    _xid++;
+    return send(DHCPMSG_DISCOVER, NULL, DHCPC_SELECTING);
+}
+
+// Selects an offer (same transaction id as the offer)
+bool DhcpClient::sendRequest(const DhcpLease& lease) {
+    return send(DHCPMSG_REQUEST, &lease, DHCPC_SELECTING);
+}
+
+// Extends a bound lease (RFC 2131 4.3.2): unicast to the server that granted
+// it (RENEWING), or broadcast to any server once that one has not answered
+// by T2 (REBINDING). "first" starts a new transaction; repeats keep its id.
+bool DhcpClient::sendRenew(const DhcpLease& lease, bool rebinding, bool first) {
+    if (first) _xid++;
+    return send(DHCPMSG_REQUEST, &lease, rebinding ? DHCPC_REBINDING : DHCPC_RENEWING);
+}
+
+// Asks to keep the address of an earlier lease, without DISCOVER (INIT-REBOOT,
+// RFC 2131 4.3.2); the server answers with ACK, or NAK if it moved on
+bool DhcpClient::sendReboot(const IPAddress& ip) {
+    DhcpLease hint = DhcpLease();
+    hint.ip = ip;
+    _xid++;
+    return send(DHCPMSG_REQUEST, &hint, DHCPC_SELECTING);
+}
+
+// ---------------------------------------------------------------------------
+// DHCPCLIENT::SEND
+// ---------------------------------------------------------------------------
+// Sends a DISCOVER or REQUEST.
+//
+// INPUTS:
+//    type           DHCPMSG_DISCOVER or DHCPMSG_REQUEST
+//    lease          Address (and server) of a REQUEST; NULL for DISCOVER
+//    mode           DHCPC_SELECTING: broadcast, asking for a broadcast
+//                   answer; the address and server identifier go in
+//                   options 50 and 54 (the identifier is left out while it
+//                   is unknown, INIT-REBOOT).
+//                   DHCPC_RENEWING/DHCPC_REBINDING: we hold the address,
+//                   so it goes in ciaddr and options 50 and 54 are left
+//                   out; unicast to the lease's server (if known), or
+//                   broadcast.
+// ---------------------------------------------------------------------------
+
+bool DhcpClient::send(uint8_t type, const DhcpLease* lease, uint8_t mode) {
+    IPAddress to(255, 255, 255, 255);
+    if (mode == DHCPC_RENEWING && !(lease->server == IPAddress(0, 0, 0, 0))) {
+        to = lease->server;
+    }
+    if (!_udp.beginPacket(to, DHCPC_SERVERPORT)) {
+        return false;
+    }
+    byte header[16] = {
+        1, 1, 6, 0,                             // BOOTREQUEST, Ethernet, address length, hops
+        (byte)(_xid >> 24), (byte)(_xid >> 16), (byte)(_xid >> 8), (byte)_xid,
+        0, 0,                                   // Seconds
+        0x80, 0x00,                             // Flags: please broadcast the reply
+        0, 0, 0, 0                              // Client address
+    };
+    if (mode != DHCPC_SELECTING) {
+        header[10] = 0;                         // We can take a unicast reply
+        for (uint8_t i = 0; i < 4; i++) header[DHCPC_CIADDROFFSET + i] = lease->ip[i];
+    }
+    _udp.write(header, sizeof(header));
+    for (uint8_t i = sizeof(header); i < DHCPC_CHADDROFFSET; i++) _udp.write((uint8_t)0);
+    _udp.write(_mac, 6);
+    for (uint8_t i = DHCPC_CHADDROFFSET + 6; i < DHCPC_FIXEDSIZE; i++) _udp.write((uint8_t)0);
+    _udp.write(dhcpCookie, sizeof(dhcpCookie));
+
+    byte options[] = {
+        53, 1, type,                            // Message type
+        55, 4, 1, 3, 6, 51                      // Ask for subnet, router, DNS and lease time
+    };
+    _udp.write(options, sizeof(options));
+    if (lease && mode == DHCPC_SELECTING) {
+        byte request[] = { 50, 4, 0, 0, 0, 0, 54, 4, 0, 0, 0, 0 };
+        for (uint8_t i = 0; i < 4; i++) {
+            request[2 + i] = lease->ip[i];
+            request[8 + i] = lease->server[i];
+        }
+        bool server = !(lease->server == IPAddress(0, 0, 0, 0));
+        _udp.write(request, server ? sizeof(request) : 6);
+    }
+    _udp.write((uint8_t)255);                   // End
+    return _udp.endPacket();
+}
+
+void DhcpClient::skip(int count) {
+    byte scratch[16];
+    while (count > 0) {
+        int n = _udp.read(scratch, count < (int)sizeof(scratch) ? count : (int)sizeof(scratch));
+        if (n <= 0) return;
+        count -= n;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// DHCPCLIENT::POLL
+// ---------------------------------------------------------------------------
+// Looks for a server answer to our current transaction.
+//
+// OUTPUTS:
+//    uint8_t        DHCPMSG_OFFER, DHCPMSG_ACK or DHCPMSG_NAK with "lease" filled in,
+//                   or DHCPMSG_NONE if nothing (relevant) arrived
+// ---------------------------------------------------------------------------
+
+uint8_t DhcpClient::poll(DhcpLease& lease) {
+    while (_udp.parsePacket() > 0) {
+        uint8_t type = DHCPMSG_NONE;
+        byte header[20];
+        if (_udp.read(header, sizeof(header)) != sizeof(header) || header[0] != 2) {
+            _udp.flush();
+            continue;
+        }
+        uint32_t xid = (uint32_t)header[4] << 24 | (uint32_t)header[5] << 16 | (uint32_t)header[6] << 8 | header[7];
+        byte cookie[4];
+        skip(DHCPC_FIXEDSIZE - sizeof(header));
+        if (xid != _xid || _udp.read(cookie, 4) != 4 || memcmp(cookie, dhcpCookie, 4)) {
+            _udp.flush();
+            continue;
+        }
+        lease.ip = IPAddress(header + 16);
+
+        // Options: code, length, value
+        int code;
+        while ((code = _udp.read()) >= 0 && code != 255) {
+            if (code == 0) continue;            // Padding
+            int length = _udp.read();
+            if (length < 0) break;
+            byte value[4];
+            int n = (length < 4) ? length : 4;
+            if (_udp.read(value, n) != n) break;
+            skip(length - n);
+            if (code == 53 && n >= 1) type = value[0];
+            else if (n == 4) {
+                if (code == 1) lease.subnet = IPAddress(value);
+                else if (code == 3) lease.gateway = IPAddress(value);
+                else if (code == 6) lease.dns = IPAddress(value);
+                else if (code == 54) lease.server = IPAddress(value);
+                else if (code == 51) lease.leaseTime = (uint32_t)value[0] << 24 | (uint32_t)value[1] << 16 |
+                                                       (uint32_t)value[2] << 8 | value[3];
+            }
+        }
+        _udp.flush();
+        if (type == DHCPMSG_OFFER || type == DHCPMSG_ACK || type == DHCPMSG_NAK) {
+            return type;
+        }
+    }
+    return DHCPMSG_NONE;
+}
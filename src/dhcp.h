@@ -0,0 +1,75 @@
+/* =============================================================================
+   Dhcp.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_DHCP_H
+#define __COMFOAIR_ARDUINO_DHCP_H
+
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+
+/* --------------------------------------------------------------------------
+   Minimal DHCP client
+   --------------------------------------------------------------------------
+   Only builds and parses the messages; it never waits. The network state
+   machine (network.cpp) decides when to send, and calls poll() from loop()
+   to pick up the server's answer whenever it arrives. Packets are written
+   and read piecewise, so no 300-byte packet buffer is needed. (Names are
+   prefixed DHCPC_/DHCPMSG_ to stay clear of the Ethernet library's own
+   Dhcp.h.)
+   -------------------------------------------------------------------------- */
+
+#define DHCPC_CLIENTPORT 68
+#define DHCPC_SERVERPORT 67
+
+// DHCP message types (option 53)
+enum DhcpMessage : uint8_t {
+    DHCPMSG_NONE = 0,
+    DHCPMSG_DISCOVER = 1,
+    DHCPMSG_OFFER = 2,
+    DHCPMSG_REQUEST = 3,
+    DHCPMSG_ACK = 5,
+    DHCPMSG_NAK = 6
+};
+
+// How a REQUEST is sent (see DhcpClient::send())
+enum DhcpMode : uint8_t {
+    DHCPC_SELECTING = 0,                        // Selecting an offer, or INIT-REBOOT
+    DHCPC_RENEWING,                             // Extending our lease with the server that granted it
+    DHCPC_REBINDING                             // Extending it with any server
+};
+
+// What the server handed out
+struct DhcpLease {
+    IPAddress ip;
+    IPAddress subnet;
+    IPAddress gateway;
+    IPAddress dns;
+    IPAddress server;                           // DHCP server identifier
+    uint32_t leaseTime;                         // Seconds
+};
+
+class DhcpClient {
+    public:
+        DhcpClient() : _mac(NULL), _xid(0) {}
+
+        void begin(const byte* mac);
+        void stop()                             { _udp.stop(); }
+
+        bool sendDiscover();
+        bool sendRequest(const DhcpLease& lease);
+        bool sendRenew(const DhcpLease& lease, bool rebinding, bool first);
+        bool sendReboot(const IPAddress& ip);
+        uint8_t poll(DhcpLease& lease);
+
+    private:
+        EthernetUDP _udp;
+        const byte* _mac;
+        uint32_t _xid;                          // Transaction id of the current exchange
+
+        bool send(uint8_t type, const DhcpLease* lease, uint8_t mode);
+        void skip(int count);
+};
+
+#endif
@@ -0,0 +1,472 @@
+/* =============================================================================
+   Http.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "http.h"
+
+#ifdef HTTP_ENABLE
+
+#include "network.h"
+#include "mqtt.h"
+#include "zehnder.h"
+#include "decoder.h"
+#include "uart.h"
+#include "commands.h"
+#include "publish.h"
+#include "poller.h"
+#include "control.h"
+#include "bus.h"
+#include "stats.h"
+#include "persist.h"
+#include "payload.h"
+#include "log.h"
+
+extern ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+// Connection states
+enum HttpState : uint8_t {
+    HTTP_IDLE = 0,                              // Waiting for a connection
+    HTTP_REQUEST,                               // Reading the request
+    HTTP_RESPONSE                               // Writing the response
+};
+
+// Responses
+enum HttpPage : uint8_t {
+    HTTP_VALUES = 0,
+    HTTP_STATS,
+    HTTP_NOTFOUND,
+    HTTP_NOTALLOWED
+};
+
+static const char httpStatus200[] PROGMEM = "200 OK";
+static const char httpStatus404[] PROGMEM = "404 Not Found";
+static const char httpStatus405[] PROGMEM = "405 Method Not Allowed";
+static const char* const httpStatus[] PROGMEM = {
+    httpStatus200,                              // HTTP_VALUES
+    httpStatus200,                              // HTTP_STATS
+    httpStatus404,                              // HTTP_NOTFOUND
+    httpStatus405                               // HTTP_NOTALLOWED
+};
+
+// Items of a response body (see httpItem()); the headers are item 0
+#define HTTP_VALUEITEMS (CAFIELD_COUNT + 2)     // Per unit: open, fields, close
+#define HTTP_STATSHEAD 3                        // Before the units: uptime/network, mqtt, lifetime
+#define HTTP_STATSITEMS 6                       // Per unit: receive, poll, control, bus, lifetime, close
+
+static EthernetServer httpServer(HTTP_PORT);
+static EthernetClient httpClient;
+static bool httpListening = false;              // Begun once: every begin() takes another socket
+static uint8_t httpState = HTTP_IDLE;
+static unsigned long httpSince;                 // millis() when the connection was accepted
+static char httpLine[HTTP_LINESIZE];            // Start of the request line
+static uint8_t httpLineLength;
+static uint8_t httpLines;                       // Request lines completed
+static uint8_t httpColumn;                      // Bytes on the current request line (saturates)
+static uint8_t httpPage;                        // HttpPage being sent
+static uint16_t httpNext;                       // Next item of the response
+
+// Where the response is in the JSON structure
+struct HttpJson {
+    bool comma;                                 // The next value needs a separating comma
+    bool group;                                 // A command object is open in /values...
+    uint8_t command;                            // ... for this command
+};
+
+static HttpJson httpJson;
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// Appends ,"key": (comma if needed)
+static void httpKey(PayloadWriter& out, const __FlashStringHelper* key) {
+    if (httpJson.comma) out.append(',');
+    out.append('"');
+    out.append(key);
+    out.append(F("\":"));
+    httpJson.comma = true;
+}
+
+// Appends ,"key":value
+static void httpValue(PayloadWriter& out, const __FlashStringHelper* key, long value) {
+    httpKey(out, key);
+    out.appendInt(value);
+}
+
+// Appends ,"key":{ - or just { without a key
+static void httpOpen(PayloadWriter& out, const __FlashStringHelper* key) {
+    if (key) {
+        httpKey(out, key);
+    } else if (httpJson.comma) {
+        out.append(',');
+    }
+    out.append('{');
+    httpJson.comma = false;
+}
+
+// Appends } or ]
+static void httpClose(PayloadWriter& out, char bracket) {
+    out.append(bracket);
+    httpJson.comma = true;
+}
+
+// Response headers
+static void httpHeaders(PayloadWriter& out) {
+    out.append(F("HTTP/1.1 "));
+    out.append((const __FlashStringHelper*)pgm_read_ptr(&httpStatus[httpPage]));
+    out.append(F("\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
+}
+
+// Item of the /values body
+static bool httpValuesItem(PayloadWriter& out, uint16_t item) {
+    if (item == 0) {
+        out.append(F("{\"units\":["));
+        httpJson.comma = false;
+        return true;
+    }
+    item--;
+    uint8_t unit = item / HTTP_VALUEITEMS;
+    uint8_t row = item % HTTP_VALUEITEMS;
+    if (unit >= ZEHNDER_UNITS) {
+        if (unit > ZEHNDER_UNITS || row > 0) return false;
+        out.append(F("]}\n"));
+        return true;
+    }
+    if (row == 0) {
+        httpOpen(out, NULL);
+        httpJson.group = false;
+    } else if (row <= CAFIELD_COUNT) {
+        long value;
+        CAField field;
+        if (publishLatest(unit, row - 1, value)) {
+            caReadField(row - 1, field);
+            // Fields are grouped per command, as on MQTT: "D2":{...}
+            if (!httpJson.group || httpJson.command != field.command) {
+                if (httpJson.group) httpClose(out, '}');
+                if (httpJson.comma) out.append(',');
+                out.append('"');
+                out.appendHex(field.command);
+                out.append(F("\":{"));
+                httpJson.comma = false;
+                httpJson.group = true;
+                httpJson.command = field.command;
+            }
+            if (httpJson.comma) out.append(',');
+            out.append('"');
+            caAppendKey(out, field);
+            out.append(F("\":"));
+            caAppendValue(out, field, value);
+            httpJson.comma = true;
+        }
+    } else {
+        if (httpJson.group) httpClose(out, '}');
+        // Fields that still hold a value restored from EEPROM (see persist.h)
+        httpValue(out, F("stale"), publishStale(unit));
+        httpClose(out, '}');
+    }
+    return true;
+}
+
+// Item of the /stats body
+static bool httpStatsItem(PayloadWriter& out, uint16_t item) {
+    if (item == 0) {
+        httpJson.comma = false;
+        httpOpen(out, NULL);
+        httpValue(out, F("uptime"), millis() / 1000);
+        httpValue(out, F("network"), networkState());
+        return true;
+    }
+    if (item == 1) {
+        httpOpen(out, F("mqtt"));
+        httpValue(out, F("connected"), mqttConnected() ? 1 : 0);
+        httpValue(out, F("queued"), mqttQueueStats().queued);
+        httpValue(out, F("dropped"), mqttQueueStats().dropped);
+#ifdef STATS_ENABLE
+        httpValue(out, F("published"), systemStats.published);
+        httpValue(out, F("failed"), systemStats.publishFailed);
+        httpValue(out, F("reconnects"), systemStats.reconnects);
+#endif
+        httpClose(out, '}');
+        return true;
+    }
+    if (item == 2) {
+#ifdef PERSIST_ENABLE
+        PersistCounters totals;
+        persistTotals(totals);
+        httpOpen(out, F("lifetime"));
+        httpValue(out, F("boots"), totals.boots);
+        httpValue(out, F("uptime"), totals.uptime);
+        httpValue(out, F("published"), totals.published);
+        httpClose(out, '}');
+#endif
+        httpKey(out, F("units"));
+        out.append('[');
+        httpJson.comma = false;
+        return true;
+    }
+    item -= HTTP_STATSHEAD;
+    uint8_t unit = item / HTTP_STATSITEMS;
+    uint8_t row = item % HTTP_STATSITEMS;
+    if (unit >= ZEHNDER_UNITS) {
+        if (unit > ZEHNDER_UNITS || row > 0) return false;
+        out.append(F("]}\n"));
+        return true;
+    }
+    switch (row) {
+        case 0: {
+            const CADecoderStats& decoder = zehnderDecoders[unit].stats();
+            UartStats uart = zehnderUarts[unit]->stats();
+            httpOpen(out, NULL);
+            httpValue(out, F("rx"), uart.bytes);
+            httpValue(out, F("tx"), uart.sent);
+            httpValue(out, F("ovf"), (long)uart.overflows + uart.overruns);
+            httpValue(out, F("frames"), decoder.frames);
+            httpValue(out, F("crc"), decoder.checksumErrors);
+            httpValue(out, F("framing"), decoder.framingErrors);
+            httpValue(out, F("noise"), decoder.noiseBytes);
+            httpValue(out, F("acks"), decoder.acks);
+            break;
+        }
+        case 1: {
+            const PollStats& poll = pollStats(unit);
+            httpOpen(out, F("poll"));
+            httpValue(out, F("requests"), poll.requests);
+            httpValue(out, F("replies"), poll.replies);
+            httpValue(out, F("timeouts"), poll.timeouts);
+            httpValue(out, F("late"), poll.late);
+            httpClose(out, '}');
+            break;
+        }
+        case 2: {
+            const ControlStats& control = controlStats(unit);
+            httpOpen(out, F("control"));
+            httpValue(out, F("received"), control.received);
+            httpValue(out, F("rejected"), control.rejected);
+            httpValue(out, F("acked"), control.acked);
+            httpValue(out, F("failed"), control.failed);
+            httpValue(out, F("latency"), control.maxLatency);
+            httpClose(out, '}');
+            break;
+        }
+        case 3: {
+#ifdef BUS_ENABLE
+            const BusStats& bus = busStats(unit);
+            httpOpen(out, F("bus"));
+            httpValue(out, F("requests"), bus.requests);
+            httpValue(out, F("replies"), bus.replies);
+            httpValue(out, F("timeouts"), bus.timeouts);
+            httpValue(out, F("noack"), bus.noAcks);
+            httpValue(out, F("unmatched"), bus.unmatched);
+            httpValue(out, F("unsolicited"), bus.unsolicited);
+            httpValue(out, F("latency"), bus.maxLatency);
+            httpClose(out, '}');
+#endif
+            break;
+        }
+        case 4: {
+#ifdef PERSIST_ENABLE
+            PersistCounters totals;
+            persistTotals(totals);
+            const PersistUnitCounters& lifetime = totals.units[unit];
+            httpOpen(out, F("lifetime"));
+            httpValue(out, F("rx"), lifetime.rx);
+            httpValue(out, F("frames"), lifetime.frames);
+            httpValue(out, F("crc"), lifetime.crc);
+            httpValue(out, F("framing"), lifetime.framing);
+            httpValue(out, F("ovf"), lifetime.overflows);
+            httpClose(out, '}');
+#endif
+            break;
+        }
+        default:
+            httpClose(out, '}');
+            break;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// HTTPITEM
+// ---------------------------------------------------------------------------
+// Appends one item of the response: the headers, or a small piece of the
+// body (which may be empty).
+//
+// OUTPUTS:
+//    bool           FALSE past the end of the response
+// ---------------------------------------------------------------------------
+
+static bool httpItem(PayloadWriter& out, uint16_t item) {
+    if (item == 0) {
+        httpHeaders(out);
+        return true;
+    }
+    switch (httpPage) {
+        case HTTP_VALUES:
+            return httpValuesItem(out, item - 1);
+        case HTTP_STATS:
+            return httpStatsItem(out, item - 1);
+        case HTTP_NOTFOUND:
+            if (item > 1) return false;
+            out.append(F("{\"error\":\"not found\"}\n"));
+            return true;
+        default:
+            if (item > 1) return false;
+            out.append(F("{\"error\":\"method not allowed\"}\n"));
+            return true;
+    }
+}
+
+// Closes the connection and waits for the next
+static void httpDone() {
+    httpClient.stop();
+    httpState = HTTP_IDLE;
+}
+
+// Picks the response from the request line
+static void httpRoute() {
+    httpLine[httpLineLength] = 0;
+    LOG_DEBUG(F("HTTP: "));
+    LOG_DEBUGLN(httpLine);
+    if (strncmp_P(httpLine, PSTR("GET "), 4) != 0) {
+        httpPage = HTTP_NOTALLOWED;
+    } else {
+        char* path = httpLine + 4;
+        path[strcspn(path, " ?")] = 0;
+        if (strcmp_P(path, PSTR("/values")) == 0) {
+            httpPage = HTTP_VALUES;
+        } else if (strcmp_P(path, PSTR("/stats")) == 0) {
+            httpPage = HTTP_STATS;
+        } else {
+            httpPage = HTTP_NOTFOUND;
+        }
+    }
+    httpNext = 0;
+    httpJson.comma = false;
+    httpState = HTTP_RESPONSE;
+}
+
+// Reads what has arrived of the request, up to the blank line after the
+// headers
+static void httpRead() {
+    for (uint8_t n = 0; n < HTTP_READCHUNK && httpClient.available() > 0; n++) {
+        char c = httpClient.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n') {
+            if (httpColumn == 0 && httpLines > 0) {
+                httpRoute();
+                return;
+            }
+            httpLines++;
+            httpColumn = 0;
+            continue;
+        }
+        if (httpLines == 0 && httpLineLength < HTTP_LINESIZE - 1) {
+            httpLine[httpLineLength++] = c;
+        }
+        if (httpColumn < 0xFF) httpColumn++;
+    }
+}
+
+// Hands a buffer to the connection. A client may take less than it is
+// given: the rest is offered again, until it takes nothing at all.
+static bool httpSend(const PayloadWriter& out) {
+    const uint8_t* at = (const uint8_t*)out.c_str();
+    size_t left = out.length();
+    while (left > 0) {
+        size_t sent = httpClient.write(at, left);
+        if (sent == 0 || sent > left) {
+            return false;
+        }
+        at += sent;
+        left -= sent;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// HTTPWRITE
+// ---------------------------------------------------------------------------
+// Writes as many items as fit in one buffer. An item that does not fit an
+// empty buffer, or a connection that stops taking data, would leave the
+// client with a cut-off body: the connection is closed instead.
+// ---------------------------------------------------------------------------
+
+static void httpWrite() {
+    PayloadWriter out(mqttPayload, sizeof(mqttPayload));
+    bool last = false;
+    for (;;) {
+        uint16_t mark = out.length();
+        HttpJson json = httpJson;
+        if (!httpItem(out, httpNext)) {
+            last = true;
+            break;
+        }
+        if (out.overflow()) {
+            if (mark == 0) {
+                LOG_ERRORLN(F("HTTP: response item too large, connection closed"));
+                httpDone();
+                return;
+            }
+            out.truncate(mark);                 // Goes into the next buffer
+            httpJson = json;
+            break;
+        }
+        httpNext++;
+    }
+    if (!httpSend(out)) {
+        LOG_DEBUGLN(F("HTTP: write failed, connection closed"));
+        httpDone();
+        return;
+    }
+    if (last) {
+        httpDone();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// HTTPMAINTAIN
+// ---------------------------------------------------------------------------
+// Loop task: accepts a connection, reads its request and writes the
+// response, one small step per call.
+// ---------------------------------------------------------------------------
+
+void httpMaintain() {
+    if (!networkUp()) {
+        return;
+    }
+    if (!httpListening) {
+        httpServer.begin();
+        httpListening = true;
+    }
+    if (httpState == HTTP_IDLE) {
+        EthernetClient client = httpServer.available();
+        if (!client) {
+            return;
+        }
+        httpClient = client;
+        httpState = HTTP_REQUEST;
+        httpSince = millis();
+        httpLineLength = 0;
+        httpLines = 0;
+        httpColumn = 0;
+    }
+    if (!httpClient.connected() || millis() - httpSince >= HTTP_TIMEOUT) {
+        LOG_DEBUGLN(F("HTTP: connection dropped"));
+        httpDone();
+        return;
+    }
+    if (httpState == HTTP_REQUEST) {
+        httpRead();
+    } else {
+        httpWrite();
+    }
+}
+
+#endif
@@ -0,0 +1,53 @@
+/* =============================================================================
+   Http.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_HTTP_H
+#define __COMFOAIR_ARDUINO_HTTP_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   HTTP status endpoint
+   --------------------------------------------------------------------------
+   A minimal HTTP server on HTTP_PORT answers two requests with JSON:
+
+      GET /values    Latest decoded value of every field, per unit and,
+                     like on MQTT, per command:
+                     {"units":[{"D2":{"t_comfort":22.50,...},"0C":{...}}]}
+      GET /stats     Uptime, network and MQTT state, and per unit the
+                     receive, decoder, polling, control and bus counters;
+                     with PERSIST_ENABLE also the counters across restarts
+                     ("lifetime", see persist.h)
+
+   Anything else is answered with 404 (or 405 for other methods). Values
+   are formatted like on MQTT (see commands.h); fields that were never
+   decoded are left out.
+
+   The server needs an address, but not the broker: it keeps answering
+   while MQTT is down. It serves one connection at a time, as a loop
+   task: every httpMaintain() reads what has arrived of the request, or
+   writes the next piece of the response, at most one mqttPayload buffer.
+   The JSON is produced piece by piece straight from the value cache and
+   the counters, so nothing is built up in memory, and the serial ports
+   are read between the pieces. Every piece fits an empty buffer; should
+   one not, or should the client stop taking data, the connection is
+   closed rather than left with a cut-off body. A connection that has not been answered
+   completely after HTTP_TIMEOUT ms is closed.
+   -------------------------------------------------------------------------- */
+
+#define HTTP_ENABLE                             // Comment out to leave the server out
+#define HTTP_PORT 80
+#define HTTP_TIMEOUT 5000                       // Longest a connection may take, request and response (ms)
+#define HTTP_LINESIZE 24                        // Bytes of the request line kept ("GET /values HTTP/1.1")
+#define HTTP_READCHUNK 64                       // Request bytes read per httpMaintain() call
+
+#ifdef HTTP_ENABLE
+
+// Function declarations
+void httpMaintain();
+
+#endif
+
+#endif
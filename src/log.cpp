@@ -0,0 +1,57 @@
+/* =============================================================================
+   Log.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "log.h"
+#include "payload.h"
+
+// ---------------------------------------------------------------------------
+// LOGHEX
+// ---------------------------------------------------------------------------
+// Writes "data" as hex digits, two at a time from a buffer on the stack.
+// ---------------------------------------------------------------------------
+
+void logHex(Print& out, const byte* data, uint16_t length) {
+    char hex[3];
+    for (uint16_t i = 0; i < length; i++) {
+        hexByte(data[i], hex);
+        out.write((const uint8_t*)hex, 2);
+    }
+}
+
+#ifdef LOG_NONBLOCKING
+
+LogBuffer logBuffer;
+
+size_t LogBuffer::write(uint8_t c) {
+    if ((uint8_t)(_head - _tail) >= LOG_BUFFERSIZE) {
+        if (!_blocking) {
+            _dropped++;
+            return 0;
+        }
+        flush(true);
+    }
+    _buffer[_head++ & (LOG_BUFFERSIZE - 1)] = c;
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// LOGBUFFER::FLUSH
+// ---------------------------------------------------------------------------
+// Moves buffered output to DEBUGOUT. Unless "wait" is set, only as much as
+// DEBUGOUT can take without blocking.
+// ---------------------------------------------------------------------------
+
+void LogBuffer::flush(bool wait) {
+    uint8_t pending = _head - _tail;
+    if (!wait) {
+        int room = DEBUGOUT.availableForWrite();
+        if (room < pending) pending = (room > 0) ? room : 0;
+    }
+    while (pending--) {
+        DEBUGOUT.write(_buffer[_tail++ & (LOG_BUFFERSIZE - 1)]);
+    }
+}
+
+#endif
@@ -0,0 +1,131 @@
+/* =============================================================================
+   Log.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_LOG_H
+#define __COMFOAIR_ARDUINO_LOG_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Leveled logging
+   --------------------------------------------------------------------------
+   All diagnostic output goes through the LOG_<LEVEL>() / LOG_<LEVEL>LN()
+   macros, which take the same arguments as print() / println(). Messages
+   above LOG_LEVEL compile to nothing, arguments included, so the build
+   flag decides what a build pays for:
+
+      -D LOG_LEVEL=LOGLEVEL_WARN      production: errors and warnings only
+      -D LOG_LEVEL=LOGLEVEL_DEBUG     every decoded frame, with a hex dump
+      -D LOG_LEVEL=LOGLEVEL_TRACE     every byte received
+
+   With LOG_NONBLOCKING defined, output is collected in a small RAM buffer
+   and logFlush() (called from loop()) only hands DEBUGOUT as many bytes as
+   its transmit buffer can take without waiting. Whatever does not fit in
+   the buffer is dropped and counted ("logdrop" in the status line, see
+   stats.h), instead of stalling the loop at the debug port's baud rate. Until setup() calls LOG_BACKGROUND(), the buffer
+   is written out synchronously so no boot messages are lost.
+   -------------------------------------------------------------------------- */
+
+#define LOGLEVEL_NONE 0
+#define LOGLEVEL_ERROR 1
+#define LOGLEVEL_WARN 2
+#define LOGLEVEL_INFO 3
+#define LOGLEVEL_DEBUG 4
+#define LOGLEVEL_TRACE 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOGLEVEL_INFO                 // Default when the build does not set one
+#endif
+
+#define LOG_BUFFERSIZE 128                      // Non-blocking output buffer; power of two, at most 128
+
+#ifdef LOG_NONBLOCKING
+
+class LogBuffer : public Print {
+    // The 8-bit indices tell full from empty only up to 128 bytes: at 256,
+    // _head - _tail would be 0 for both
+    static_assert(LOG_BUFFERSIZE <= 128 && (LOG_BUFFERSIZE & (LOG_BUFFERSIZE - 1)) == 0,
+                  "Log buffer size must be a power of two up to 128");
+
+    public:
+        LogBuffer() : _head(0), _tail(0), _blocking(true), _dropped(0) {}
+
+        size_t write(uint8_t c);
+        using Print::write;
+
+        void flush(bool wait);
+        void background()                       { _blocking = false; }
+        uint16_t dropped() const                { return _dropped; }
+
+    private:
+        uint8_t _head;
+        uint8_t _tail;
+        bool _blocking;
+        uint16_t _dropped;                      // Bytes lost to a full buffer
+        byte _buffer[LOG_BUFFERSIZE];
+};
+
+extern LogBuffer logBuffer;
+
+#define LOGOUT logBuffer
+#define LOG_FLUSH() logBuffer.flush(false)
+#define LOG_BACKGROUND() logBuffer.background()
+
+#else
+
+#define LOGOUT DEBUGOUT
+#define LOG_FLUSH()
+#define LOG_BACKGROUND()
+
+#endif
+
+#if LOG_LEVEL >= LOGLEVEL_ERROR
+#define LOG_ERROR(...) LOGOUT.print(__VA_ARGS__)
+#define LOG_ERRORLN(...) LOGOUT.println(__VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#define LOG_ERRORLN(...)
+#endif
+
+#if LOG_LEVEL >= LOGLEVEL_WARN
+#define LOG_WARN(...) LOGOUT.print(__VA_ARGS__)
+#define LOG_WARNLN(...) LOGOUT.println(__VA_ARGS__)
+#else
+#define LOG_WARN(...)
+#define LOG_WARNLN(...)
+#endif
+
+#if LOG_LEVEL >= LOGLEVEL_INFO
+#define LOG_INFO(...) LOGOUT.print(__VA_ARGS__)
+#define LOG_INFOLN(...) LOGOUT.println(__VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#define LOG_INFOLN(...)
+#endif
+
+#if LOG_LEVEL >= LOGLEVEL_DEBUG
+#define LOG_DEBUG(...) LOGOUT.print(__VA_ARGS__)
+#define LOG_DEBUGLN(...) LOGOUT.println(__VA_ARGS__)
+#define LOG_DEBUGHEX(data, length) logHex(LOGOUT, data, length)
+#else
+#define LOG_DEBUG(...)
+#define LOG_DEBUGLN(...)
+#define LOG_DEBUGHEX(data, length)
+#endif
+
+#if LOG_LEVEL >= LOGLEVEL_TRACE
+#define LOG_TRACE(...) LOGOUT.print(__VA_ARGS__)
+#define LOG_TRACELN(...) LOGOUT.println(__VA_ARGS__)
+#define LOG_TRACEHEX(data, length) logHex(LOGOUT, data, length)
+#else
+#define LOG_TRACE(...)
+#define LOG_TRACELN(...)
+#define LOG_TRACEHEX(data, length)
+#endif
+
+// Function declarations
+void logHex(Print& out, const byte* data, uint16_t length);
+
+#endif
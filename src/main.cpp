@@ -2,6 +2,16 @@
 #include "mqtt.h"
 #include "network.h"
 #include "zehnder.h"
+#include "publish.h"
+#include "poller.h"
+#include "control.h"
+#include "stats.h"
+#include "bus.h"
+#include "log.h"
+#include "capture.h"
+#include "scheduler.h"
+#include "http.h"
+#include "persist.h"
 
 /* --------------------------------------------------------------------------
    Definitions
@@ -24,6 +34,64 @@ IPAddress netSubNet(255, 255, 255, 0);
 IPAddress netMQTTServer_IP(172, 16, 0, 6);
 const char* netMQTTServer_DNS = "mqtt.home.local";
 
+/* --------------------------------------------------------------------------
+   Loop tasks (see scheduler.h)
+   -------------------------------------------------------------------------- */
+
+// Maintain the MQTT connection and send queued messages once we have an address
+static void mqttTask() {
+    if (networkUp()) {
+        mqttMaintain();
+    }
+}
+
+static const char task_control[] PROGMEM = "control";
+static const char task_poll[] PROGMEM = "poll";
+#ifdef BUS_ENABLE
+static const char task_bus[] PROGMEM = "bus";
+#endif
+static const char task_publish[] PROGMEM = "publish";
+#ifdef CAPTURE_ENABLE
+static const char task_capture[] PROGMEM = "capture";
+#endif
+static const char task_mqtt[] PROGMEM = "mqtt";
+static const char task_network[] PROGMEM = "network";
+#ifdef HTTP_ENABLE
+static const char task_http[] PROGMEM = "http";
+#endif
+#ifdef PERSIST_ENABLE
+static const char task_persist[] PROGMEM = "persist";
+#endif
+
+static const SchedTask loopTasks[] PROGMEM = {
+    // Repeat unacknowledged writes to the unit
+    { task_control, controlMaintain,  10,                    200, SCHED_CRITICAL },
+    // Send writes and requests to the unit when the line is free
+    { task_poll,    pollMaintain,     0,                     500, SCHED_HIGH },
+#ifdef BUS_ENABLE
+    // Missing replies and ACKs, and the periodic bus timing report
+    { task_bus,     busMaintain,      10,                   1000, SCHED_HIGH },
+#endif
+    // Send decoded data once the publish window expires
+    { task_publish, publishMaintain,  100,                  3000, SCHED_NORMAL },
+#ifdef CAPTURE_ENABLE
+    // Send the raw capture chunk once it is old enough
+    { task_capture, captureMaintain,  100,                  1000, SCHED_NORMAL },
+#endif
+    // Broker connection and outbound queue
+    { task_mqtt,    mqttTask,         0,                    5000, SCHED_NORMAL },
+    // Bring up the network / maintain the DHCP lease, one step at a time
+    { task_network, networkMaintain,  NET_MAINTAIN_INTERVAL, 2000, SCHED_LOW },
+#ifdef HTTP_ENABLE
+    // Status requests over HTTP, one piece of a response at a time
+    { task_http,    httpMaintain,     0,                    3000, SCHED_LOW },
+#endif
+#ifdef PERSIST_ENABLE
+    // Keep values, counters and the address in EEPROM, one byte at a time
+    { task_persist, persistMaintain,  10,                   1000, SCHED_LOW },
+#endif
+};
+
 /* ===========================================================================
    ===========================================================================
    ===========================================================================
@@ -34,8 +102,8 @@ const char* netMQTTServer_DNS = "mqtt.home.local";
 
 void setup() {
     DEBUGOUT.begin(ARDUINO_BAUDRATE);
-    DEBUGOUT.println("");
-    DEBUGOUT.println(F("=== SETUP START ==="));
+    LOG_INFOLN();
+    LOG_INFOLN(F("=== SETUP START ==="));
 
     // Init serial port reader...
     zehnderInit();
@@ -43,11 +111,20 @@ void setup() {
     // Initialize MQTTClient
     mqttInit();
 
-    // Initialize EthernetClient
+#ifdef PERSIST_ENABLE
+    // Last-known values, lifetime counters and DHCP address from EEPROM
+    persistInit();
+#endif
+
+    // Initialize EthernetClient (brought up from loop())
     networkInit();
 
+    // Everything else runs from the loop tasks
+    schedInit(loopTasks, sizeof(loopTasks) / sizeof(loopTasks[0]), checkCommand);
+
       
-    DEBUGOUT.println(F("=== SETUP DONE ==="));
+    LOG_INFOLN(F("=== SETUP DONE ==="));
+    LOG_BACKGROUND();
     pinMode(LED_BUILTIN, OUTPUT);
 }
 
@@ -61,12 +138,14 @@ void setup() {
    =========================================================================== */
 
 void loop() {
-    // Maintain Ethernet connection (DHCP lease)
-    Ethernet.maintain();
-    
-    // Maintain MQTT server connection
-    mqttMaintain();
-
-    // New data available at the serial port?
-    checkCommand();
+    // Read the serial ports between all tasks, run the tasks as they fall due
+    schedRun();
+
+#ifdef STATS_ENABLE
+    // Loop timing, memory watermark and the periodic status line
+    statsMaintain();
+#endif
+
+    // Hand buffered log output to the debug port, without waiting
+    LOG_FLUSH();
 }
@@ -4,6 +4,11 @@
   ============================================================================= */
 
 #include "mqtt.h"
+#include "commands.h"
+#include "zehnder.h"
+#include "control.h"
+#include "stats.h"
+#include "log.h"
 
 /*=============================================================================
    GLOBAL VARIABLES 
@@ -17,65 +22,219 @@ extern EthernetClient netClient;
 // MQTT Client
 PubSubClient mqttClient(netClient);
 long lastReconnectAttempt = 0;
+unsigned long reconnectInterval = MQTT_RECONNECT_MIN;
+
+// Outgoing payload being built (see mqtt.h)
+char mqttPayload[MQTT_MAX_PAYLOAD_SIZE];
+
+// Outbound queue
+byte mqttQueueBuffer[MQTT_QUEUE_SIZE];
+MessageQueue mqttQueue(mqttQueueBuffer, MQTT_QUEUE_SIZE, MQTT_QUEUE_POLICY);
+
+// Topics: the unit prefixes and field keys stay in flash, a topic is only
+// put together while its message is being sent
+static const char mqttPrefix0[] PROGMEM = MQTTTOPIC_UNIT0;
+#if ZEHNDER_UNITS > 1
+static const char mqttPrefix1[] PROGMEM = MQTTTOPIC_UNIT1;
+#endif
+#if ZEHNDER_UNITS > 2
+static const char mqttPrefix2[] PROGMEM = MQTTTOPIC_UNIT2;
+#endif
+static const char* const mqttPrefixes[ZEHNDER_UNITS] PROGMEM = {
+    mqttPrefix0,
+#if ZEHNDER_UNITS > 1
+    mqttPrefix1,
+#endif
+#if ZEHNDER_UNITS > 2
+    mqttPrefix2,
+#endif
+};
+static char mqttTopic[MQTTTOPIC_PREFIXLENGTH + sizeof(MQTTTOPIC_DATA "/") - 1 + CAFIELD_KEYSIZE];
+
+static_assert(MQTT_TOPIC_FIELD + CAFIELD_COUNT <= MQTT_TOPIC_UNIT, "Too many fields for per-field topic ids");
+static_assert(sizeof(MQTTTOPIC_STALE) <= sizeof(MQTTTOPIC_SYSTEM), "MQTT_MAX_PAYLOAD_SIZE assumes /system is the longest topic");
+static_assert(MQTT_TOPIC_UNIT * ZEHNDER_UNITS <= QUEUE_WRAP, "Too many units for the queue's topic ids");
 
 /*=============================================================================
    FUNCTIONS
   ============================================================================= */
 
 void mqttInit() { 
-    DEBUGOUT.println(F("Preparing MQTT client..."));
+    LOG_INFOLN(F("Preparing MQTT client..."));
     mqttClient.setServer(netMQTTServer_DNS, MQTTPORT);
     mqttClient.setCallback(mqttCallback);
+    mqttClient.setSocketTimeout(MQTT_SOCKETTIMEOUT);
+}
+
+// Queue a payload for the data topic of a unit. It is sent from
+// mqttMaintain(), or replayed after a reconnect if the broker is down.
+boolean mqttPublishData(const char* payload, unsigned int length, uint8_t unit) {
+    if (!mqttQueue.push(MQTT_TOPIC_UNIT * unit + MQTT_TOPIC_DATA, (const byte*)payload, length)) {
+        LOG_ERRORLN(F("ERROR: MQTT queue full, message dropped!"));
+        return false;
+    }
+    return true;
+}
+
+// Queue a payload for the system topic of a unit
+boolean mqttPublishSystem(const char* payload, unsigned int length, uint8_t unit) {
+    if (!mqttQueue.push(MQTT_TOPIC_UNIT * unit + MQTT_TOPIC_SYSTEM, (const byte*)payload, length)) {
+        LOG_ERRORLN(F("ERROR: MQTT queue full, message dropped!"));
+        return false;
+    }
+    return true;
+}
+
+// Queue a payload for the stale topic of a unit: values restored from
+// EEPROM, not decoded since the restart
+boolean mqttPublishStale(const char* payload, unsigned int length, uint8_t unit) {
+    if (!mqttQueue.push(MQTT_TOPIC_UNIT * unit + MQTT_TOPIC_STALE, (const byte*)payload, length)) {
+        LOG_ERRORLN(F("ERROR: MQTT queue full, message dropped!"));
+        return false;
+    }
+    return true;
+}
+
+// Queue a retained value for the topic of field "index" in caFields[]
+boolean mqttPublishField(uint8_t index, const char* payload, unsigned int length, uint8_t unit) {
+    if (!mqttQueue.push(MQTT_TOPIC_UNIT * unit + MQTT_TOPIC_FIELD + index, (const byte*)payload, length)) {
+        LOG_ERRORLN(F("ERROR: MQTT queue full, message dropped!"));
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// MQTTTOPICNAME
+// ---------------------------------------------------------------------------
+// Builds the topic of a queue topic id in mqttTopic: the unit's prefix,
+// followed by /system, /data, /capture, /board, /stale or /data/<key>.
+// ---------------------------------------------------------------------------
+
+static const char* mqttTopicName(uint8_t topic) {
+    uint8_t kind = topic % MQTT_TOPIC_UNIT;
+    strcpy_P(mqttTopic, (const char*)pgm_read_ptr(&mqttPrefixes[topic / MQTT_TOPIC_UNIT]));
+    char* end = mqttTopic + strlen(mqttTopic);
+    if (kind == MQTT_TOPIC_SYSTEM) {
+        strcpy_P(end, PSTR(MQTTTOPIC_SYSTEM));
+    } else if (kind == MQTT_TOPIC_CAPTURE) {
+        strcpy_P(end, PSTR(MQTTTOPIC_CAPTURE));
+    } else if (kind == MQTT_TOPIC_BOARD) {
+        strcpy_P(end, PSTR(MQTTTOPIC_BOARD));
+    } else if (kind == MQTT_TOPIC_STALE) {
+        strcpy_P(end, PSTR(MQTTTOPIC_STALE));
+    } else if (kind >= MQTT_TOPIC_FIELD) {
+        CAField field;
+        caReadField(kind - MQTT_TOPIC_FIELD, field);
+        strcpy_P(end, PSTR(MQTTTOPIC_DATA "/"));
+        end += sizeof(MQTTTOPIC_DATA "/") - 1;
+        strncpy_P(end, field.key, CAFIELD_KEYSIZE - 1);
+        mqttTopic[sizeof(mqttTopic) - 1] = 0;
+    } else {
+        strcpy_P(end, PSTR(MQTTTOPIC_DATA));
+    }
+    return mqttTopic;
+}
+
+// Queue a binary chunk for the MQTTPUBTOPIC_CAPTURE topic. Capture data may
+// only use half of the queue, so it never pushes measurements out.
+boolean mqttPublishCapture(const byte* payload, unsigned int length) {
+    if (mqttQueue.used() + QUEUE_HEADERSIZE + length > MQTT_QUEUE_SIZE / 2) {
+        return false;
+    }
+    return mqttQueue.push(MQTT_TOPIC_CAPTURE, payload, length);
+}
+
+// ---------------------------------------------------------------------------
+// MQTTDRAINQUEUE
+// ---------------------------------------------------------------------------
+// Sends at most "maxMessages" queued messages, straight from the queue's
+// memory. A message that cannot be sent stays queued for the next attempt.
+// ---------------------------------------------------------------------------
+
+void mqttDrainQueue(uint8_t maxMessages) {
+    uint8_t topic;
+    const byte* payload;
+    uint16_t length;
+    while ((maxMessages-- > 0) && mqttClient.connected() && mqttQueue.peek(topic, payload, length)) {
+        boolean retained = (topic % MQTT_TOPIC_UNIT) >= MQTT_TOPIC_FIELD;
+        if (!mqttClient.publish(mqttTopicName(topic), payload, length, retained)) {
+            LOG_ERRORLN(F("ERROR: Failed to publish to MQTT server!"));
+            STATS_INC(publishFailed);
+            return;
+        }
+        STATS_INC(published);
+        mqttQueue.pop();
+    }
 }
 
-// Publish a payload to the MQTTPUBTOPIC_DATA topic
-boolean mqttPublishData(String payload) {
-    // Publish data to MQTT queue
-    if (mqttClient.connected()) {
-        char __dataOut[MQTT_MAX_PACKET_SIZE];
-        payload.toCharArray(__dataOut, MQTT_MAX_PACKET_SIZE);
-        if(mqttClient.publish(MQTTPUBTOPIC_DATA,__dataOut)) {
-            return true;
-        };
-        DEBUGOUT.println(F("ERROR: Failed to publish to MQTT server!"));
-    }    
-    return false;
+const QueueStats& mqttQueueStats() {
+    return mqttQueue.stats();
+}
+
+// Bytes waiting in the outbound queue
+uint16_t mqttQueueUsed() {
+    return mqttQueue.used();
 }
 
 
 void mqttMaintain() {
     if (!mqttClient.connected()) {
       long now = millis();
-      if (now - lastReconnectAttempt > 5000) {
+      if (now - lastReconnectAttempt > (long)reconnectInterval) {
         lastReconnectAttempt = now;
-        // Attempt to reconnect
-        if (mqttReconnect()) {
+        // Attempt to reconnect; back off while the broker stays away
+        STATS_INC(reconnects);
+        bool connected = mqttReconnect();
+        STATS_ADD(reconnectMillis, millis() - now);
+        if (connected) {
           lastReconnectAttempt = 0;
+          reconnectInterval = MQTT_RECONNECT_MIN;
+        } else {
+          reconnectInterval *= 2;
+          if (reconnectInterval > MQTT_RECONNECT_MAX) reconnectInterval = MQTT_RECONNECT_MAX;
         }
       }
     } else {
-      // Check MQTT situation
+      // Check MQTT situation and send a few queued messages
       mqttClient.loop();
+      mqttDrainQueue(MQTT_QUEUE_DRAIN);
     }
 }
 
+boolean mqttConnected() {
+    return mqttClient.connected();
+}
+
 boolean mqttReconnect() {
      // Succesfully reconnected
-     DEBUGOUT.print(F("Attempting to connect to MQTT server... "));
+     LOG_INFO(F("Attempting to connect to MQTT server... "));
      if (mqttClient.connect(MQTTCLIENTNAME)) {
-        DEBUGOUT.println(F("SUCCESS!"));
+        LOG_INFOLN(F("SUCCESS!"));
         // Once connected, publish an announcement...
         if(!mqttClient.publish(MQTTPUBTOPIC_SYSTEM, MQTT_MSG_CONNECTIONOK)) {
-             DEBUGOUT.println(F("ERROR: Failed to publish to MQTT server!"));
+             LOG_ERRORLN(F("ERROR: Failed to publish to MQTT server!"));
+             STATS_INC(publishFailed);
+        } else {
+             STATS_INC(published);
+        }
+        // ... and resubscribe to the board topic of every unit
+        for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+            mqttClient.subscribe(mqttTopicName(MQTT_TOPIC_UNIT * unit + MQTT_TOPIC_BOARD));
         }
-        // ... and resubscribe
-        mqttClient.subscribe(MQTTSUBTOPIC);
       } else {
-        DEBUGOUT.println(F("FAILED!"));
+        LOG_INFOLN(F("FAILED!"));
       }
       return mqttClient.connected();
 }
 
+// Commands for a unit arrive on its board topic, the only topics we
+// subscribe to
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
-    // handle message arrived
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        if (!strcmp(topic, mqttTopicName(MQTT_TOPIC_UNIT * unit + MQTT_TOPIC_BOARD))) {
+            controlMessage(unit, payload, length);
+            return;
+        }
+    }
 }
@@ -9,16 +9,61 @@
 #define MQTT_MAX_PACKET_SIZE 256
 #include <PubSubClient.h>
 #include "network.h"
+#include "queue.h"
 
 
 // MQTT IP configuration
 #define MQTTPORT 1883
 #define MQTTCLIENTNAME "arduinoClient"
+#define MQTT_SOCKETTIMEOUT 2                    // Seconds to wait for broker responses (library default: 15)
+#define MQTT_RECONNECT_MIN 5000                 // First reconnect attempt after this many ms...
+#define MQTT_RECONNECT_MAX 60000                // ... doubling up to this interval while the broker is down
 
-// MQTT Topics
-#define MQTTPUBTOPIC_SYSTEM "smarthome/ventilation/zehnder450D/system"            // Publish system messages here
-#define MQTTPUBTOPIC_DATA "smarthome/ventilation/zehnder450D/data"                // Publish measurements here
-#define MQTTSUBTOPIC "smarthome/ventilation/zehnder450D/board"                    // Subscribe here
+// Outbound queue: messages wait here until the broker accepts them
+#define MQTT_QUEUE_SIZE 1024                    // Bytes reserved for pending messages
+#define MQTT_QUEUE_POLICY QUEUE_DROP_OLDEST     // What to discard when the queue is full
+#define MQTT_QUEUE_DRAIN 2                      // Messages sent per mqttMaintain() call
+
+// Topic ids used in the queue: MQTT_TOPIC_UNIT * unit + one of these
+enum MqttTopic : uint8_t {
+    MQTT_TOPIC_SYSTEM = 0,
+    MQTT_TOPIC_DATA,
+    MQTT_TOPIC_CAPTURE,
+    MQTT_TOPIC_BOARD,                           // Subscription only, never queued
+    MQTT_TOPIC_STALE,                           // Values restored from EEPROM after a restart
+    MQTT_TOPIC_FIELD,                           // + row in caFields[]: <data topic>/<key> (retained)
+    MQTT_TOPIC_UNIT = 0x40                      // Distance between the ids of two units
+};
+
+// MQTT Topics: every unit has its own prefix (see ZEHNDER_UNITS)
+#define MQTTTOPIC_UNIT0 "smarthome/ventilation/zehnder450D"                       // Unit 0 (Serial1)
+#define MQTTTOPIC_UNIT1 "smarthome/ventilation/zehnder450D-2"                     // Unit 1 (Serial2)
+#define MQTTTOPIC_UNIT2 "smarthome/ventilation/zehnder450D-3"                     // Unit 2 (Serial3)
+#define MQTTTOPIC_SYSTEM "/system"                                                // Publish system messages here
+#define MQTTTOPIC_DATA "/data"                                                    // Publish measurements here
+#define MQTTTOPIC_CAPTURE "/capture"                                              // Raw bus capture chunks (unit 0 only, see capture.h)
+#define MQTTTOPIC_BOARD "/board"                                                  // Subscribe here
+#define MQTTTOPIC_STALE "/stale"                                                  // Restored values, in the data format (see persist.h)
+
+// Full topics of unit 0
+#define MQTTPUBTOPIC_SYSTEM MQTTTOPIC_UNIT0 MQTTTOPIC_SYSTEM
+#define MQTTPUBTOPIC_DATA MQTTTOPIC_UNIT0 MQTTTOPIC_DATA
+#define MQTTPUBTOPIC_CAPTURE MQTTTOPIC_UNIT0 MQTTTOPIC_CAPTURE
+#define MQTTPUBTOPIC_STALE MQTTTOPIC_UNIT0 MQTTTOPIC_STALE
+#define MQTTSUBTOPIC MQTTTOPIC_UNIT0 MQTTTOPIC_BOARD
+
+// Longest unit prefix
+#define __MQTT_MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MQTTTOPIC_PREFIXLENGTH (__MQTT_MAX(sizeof(MQTTTOPIC_UNIT0), __MQTT_MAX(sizeof(MQTTTOPIC_UNIT1), sizeof(MQTTTOPIC_UNIT2))) - 1)
+
+// Largest payload that still fits a packet on any unit's system, data or
+// stale topic (fixed header + topic length field + topic)
+#define MQTT_MAX_PAYLOAD_SIZE (MQTT_MAX_PACKET_SIZE - 5 - 2 - MQTTTOPIC_PREFIXLENGTH - (sizeof(MQTTTOPIC_SYSTEM) - 1))
+
+// Scratch buffer in which every module builds its outgoing payload. There is
+// only one, shared: a payload must be handed to mqttPublish*() before
+// anything else may be formatted.
+extern char mqttPayload[MQTT_MAX_PAYLOAD_SIZE];
 
 // MQTT Messages
 #define MQTT_MSG_CONNECTIONOK "command=00 status=1"
@@ -29,6 +74,14 @@ boolean mqttReconnect();
 void mqttMaintain();
 void mqttCallback(char* topic, byte* payload, unsigned int length);
 
-boolean mqttPublishData(String payload);
+boolean mqttPublishData(const char* payload, unsigned int length, uint8_t unit = 0);
+boolean mqttPublishSystem(const char* payload, unsigned int length, uint8_t unit = 0);
+boolean mqttPublishStale(const char* payload, unsigned int length, uint8_t unit = 0);
+boolean mqttPublishField(uint8_t index, const char* payload, unsigned int length, uint8_t unit = 0);
+boolean mqttPublishCapture(const byte* payload, unsigned int length);
+void mqttDrainQueue(uint8_t maxMessages);
+boolean mqttConnected();
+const QueueStats& mqttQueueStats();
+uint16_t mqttQueueUsed();
 
 #endif
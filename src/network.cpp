@@ -4,6 +4,8 @@
   ============================================================================= */
 
 #include "network.h"
+#include "dhcp.h"
+#include "log.h"
 
 /*=============================================================================
    GLOBAL VARIABLES 
@@ -20,44 +22,197 @@ extern IPAddress netDNS;
 extern IPAddress netGW;
 extern IPAddress netSubNet;
 
+static DhcpClient netDhcp;
+static DhcpLease netLease;
+static uint8_t netState = NET_START;
+static unsigned long netLastStep = 0;
+static unsigned long netStateSince;             // millis() when the current state was entered
+static unsigned long netLastSend;               // millis() of the last DHCP message
+static bool netRenewing = false;                // REQUEST renews a bound lease
+static bool netRebooting = false;               // REQUEST asks for the address of an earlier lease
+static IPAddress netHint;                       // That address (0.0.0.0: none)
+static bool netInitialised = false;             // Ethernet chip initialised (once, at the first START)
+
 /*=============================================================================
    FUNCTIONS
   ============================================================================= */
 
-void(* SoftReset) (void) = 0;       // declare reset function @ address 0
+static void networkEnter(uint8_t state) {
+    netState = state;
+    netStateSince = millis();
+    netLastSend = netStateSince;
+}
 
-void networkInit() {
-    // Initialize network
-    DEBUGOUT.println(F("Init network connection..."));
-    DEBUGOUT.println(F("-> Trying to get an IP address using DHCP"));
-    if (Ethernet.begin(netMAC) == 0) {
-        DEBUGOUT.println(F("-> Failed to configure Ethernet using DHCP; trying static config!"));
-        // initialize the Ethernet device not using DHCP:
-        Ethernet.begin(netMAC, netIP, netDNS, netGW, netSubNet);
-        // Wait until Ethernet client ready
-        DEBUGOUT.print(F("-> Connecting..."));
-        int loopcounter = 0;
-        while(!netClient){
-            // Wait until there is a client connected to proceed
-            delay(250);
-            DEBUGOUT.print(F("."));
-            loopcounter++;
-            if (loopcounter > 120) {
-                DEBUGOUT.println(); DEBUGOUT.println(F("ERROR! Cannot connect to network; rebooting!"));
-                delay(2000);
-                SoftReset();
-            }
-        }
-        DEBUGOUT.println(F(" DONE!"));
-    }
-    
-    // Print our local IP address:
-    DEBUGOUT.print("-> Current IP address: ");
+// Configures an address on the running chip. Unlike Ethernet.begin(), this
+// leaves the W5500 and its open sockets (DHCP, MQTT, HTTP) alone.
+static void networkConfigure(const IPAddress& ip, const IPAddress& dns, const IPAddress& gateway,
+                             const IPAddress& subnet) {
+    Ethernet.setLocalIP(ip);
+    Ethernet.setSubnetMask(subnet);
+    Ethernet.setGatewayIP(gateway);
+    Ethernet.setDnsServerIP(dns);
+}
+
+static void networkPrintIP() {
+    LOG_INFO(F("-> Current IP address: "));
     netIP = Ethernet.localIP();
     for (byte thisByte = 0; thisByte < 4; thisByte++) {
         // print the value of each byte of the IP address:
-        DEBUGOUT.print(netIP[thisByte], DEC);
-        DEBUGOUT.print(".");
+        LOG_INFO(netIP[thisByte], DEC);
+        LOG_INFO('.');
+    }
+    LOG_INFOLN();
+}
+
+void networkInit() {
+    // The actual work happens step by step in networkMaintain()
+    LOG_INFOLN(F("Init network connection..."));
+    DhcpLease lease;
+    if (networkLease(lease)) {
+        netHint = lease.ip;                     // Starting over: ask for the address we have
+    }
+    networkEnter(NET_START);
+}
+
+// TRUE once we have an address (leased, being renewed, or static)
+bool networkUp() {
+    return netState == NET_BOUND || netState == NET_STATIC || (netState == NET_REQUEST && netRenewing);
+}
+
+// Half the lease time in ms, when renewal is due; very long (or infinite)
+// leases are renewed every NET_LEASE_MAX seconds
+static unsigned long networkHalfLease() {
+    uint32_t lease = netLease.leaseTime;
+    if (lease == 0 || lease > NET_LEASE_MAX) lease = NET_LEASE_MAX;
+    return lease * 500UL;
+}
+
+uint8_t networkState() {
+    return netState;
+}
+
+// Address to ask for first, from before a restart (see persist.h); call
+// before the first networkMaintain()
+void networkHint(const IPAddress& ip) {
+    netHint = ip;
+}
+
+// The current DHCP lease; FALSE while there is none (static address or
+// still discovering)
+bool networkLease(DhcpLease& lease) {
+    if (netState != NET_BOUND && !(netState == NET_REQUEST && netRenewing)) {
+        return false;
+    }
+    lease = netLease;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// NETWORKMAINTAIN
+// ---------------------------------------------------------------------------
+// Call from loop(): advances the bring-up and lease state machine by one
+// step, never waiting for the network.
+// ---------------------------------------------------------------------------
+
+void networkMaintain() {
+    unsigned long now = millis();
+    if (now - netLastStep < NET_MAINTAIN_INTERVAL) {
+        return;
+    }
+    netLastStep = now;
+
+    DhcpLease answer = netLease;
+    uint8_t reply = DHCPMSG_NONE;
+    if (netState != NET_STATIC && netState != NET_START) {
+        reply = netDhcp.poll(answer);
+    }
+
+    switch (netState) {
+        case NET_START:
+            LOG_INFOLN(F("-> Trying to get an IP address using DHCP"));
+            if (!netInitialised) {
+                Ethernet.begin(netMAC, IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0),
+                               IPAddress(0, 0, 0, 0));
+                netInitialised = true;
+            }
+            netRenewing = false;
+            netRebooting = false;
+            netDhcp.begin(netMAC);
+            if (!(netHint == IPAddress(0, 0, 0, 0))) {
+                // Try to keep the address we had before the restart
+                netLease = DhcpLease();
+                netLease.ip = netHint;
+                netDhcp.sendReboot(netHint);
+                netRebooting = true;
+                networkEnter(NET_REQUEST);
+                break;
+            }
+            netDhcp.sendDiscover();
+            networkEnter(NET_DISCOVER);
+            break;
+
+        case NET_DISCOVER:
+            if (reply == DHCPMSG_OFFER) {
+                netLease = answer;
+                netDhcp.sendRequest(netLease);
+                netRenewing = false;
+                networkEnter(NET_REQUEST);
+            } else if (now - netStateSince >= NET_DHCP_TIMEOUT) {
+                LOG_WARNLN(F("-> Failed to configure Ethernet using DHCP; trying static config!"));
+                netDhcp.stop();
+                networkConfigure(netIP, netDNS, netGW, netSubNet);
+                networkPrintIP();
+                networkEnter(NET_STATIC);
+            } else if (now - netLastSend >= NET_DHCP_RETRY) {
+                netDhcp.sendDiscover();
+                netLastSend = now;
+            }
+            break;
+
+        case NET_REQUEST:
+            if (reply == DHCPMSG_ACK) {
+                netLease = answer;
+                netRebooting = false;
+                if (!netRenewing) {
+                    networkConfigure(netLease.ip, netLease.dns, netLease.gateway, netLease.subnet);
+                    networkPrintIP();
+                }
+                networkEnter(NET_BOUND);
+            } else if (reply == DHCPMSG_NAK || (netRebooting && now - netStateSince >= NET_DHCP_REBOOT)) {
+                // Address no longer ours (or nobody confirms it): start over
+                netRenewing = false;
+                netRebooting = false;
+                netDhcp.sendDiscover();
+                networkEnter(NET_DISCOVER);
+            } else if (netRenewing && now - netStateSince >= networkHalfLease()) {
+                LOG_WARNLN(F("-> DHCP lease expired"));
+                netRenewing = false;
+                netDhcp.sendDiscover();
+                networkEnter(NET_DISCOVER);
+            } else if (!netRenewing && now - netStateSince >= NET_DHCP_TIMEOUT) {
+                netDhcp.sendDiscover();
+                networkEnter(NET_DISCOVER);
+            } else if (now - netLastSend >= NET_DHCP_RETRY) {
+                if (netRenewing) {
+                    // From T2 (7/8 of the lease) on, any server may extend it
+                    netDhcp.sendRenew(netLease, now - netStateSince >= networkHalfLease() / 4 * 3, false);
+                } else {
+                    netDhcp.sendRequest(netLease);
+                }
+                netLastSend = now;
+            }
+            break;
+
+        case NET_BOUND:
+            // Renew at half the lease time (T1); the address stays usable meanwhile
+            if (now - netStateSince >= networkHalfLease()) {
+                netDhcp.sendRenew(netLease, false, true);
+                netRenewing = true;
+                networkEnter(NET_REQUEST);
+            }
+            break;
+
+        case NET_STATIC:
+            break;
     }
-    DEBUGOUT.println();
-}
\ No newline at end of file
+}
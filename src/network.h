@@ -6,11 +6,66 @@
 #ifndef __COMFOAIR_ARDUINO_NETWORK_H
 #define __COMFOAIR_ARDUINO_NETWORK_H
 
-#include <Ethernet2.h>
+#include <Ethernet.h>
+#include "dhcp.h"
 
+/* --------------------------------------------------------------------------
+   Network bring-up
+   --------------------------------------------------------------------------
+   A state machine driven from loop() brings the network up in small steps,
+   so the Zehnder port is read from the very first loop():
+
+      START     Initialise the Ethernet chip without an address (the only
+                time; addresses are later set on the running chip, so
+                open sockets survive)
+      DISCOVER  Broadcast DHCP DISCOVER (repeated every NET_DHCP_RETRY)
+      REQUEST   Request the offered address
+      BOUND     Address configured; renew at half the lease time (T1)
+      STATIC    No DHCP server answered within NET_DHCP_TIMEOUT: use the
+                static configuration from main.cpp
+
+   With the address of an earlier lease (networkHint(), kept in EEPROM by
+   persist.cpp), START skips DISCOVER and goes straight to REQUEST for that
+   address (INIT-REBOOT). A NAK, or no answer within NET_DHCP_REBOOT, falls
+   back to DISCOVER.
+
+   Renewal follows RFC 2131: the REQUEST carries our address in ciaddr and
+   goes by unicast to the server that granted the lease. If that server
+   has not answered by T2 (7/8 of the lease), it is broadcast to any
+   server instead (REBINDING). A lease that cannot be renewed before it
+   expires starts over at DISCOVER.
+
+   The chip is initialised at the first START only: the Ethernet library
+   resets the W5500 on its first begin() and never again, and a later
+   begin() would only zero the address under the open sockets. Calling
+   networkInit() again starts DHCP over on the running chip (asking for
+   the address it holds); the MQTT and HTTP sockets stay open.
+
+   networkMaintain() does its work at most every NET_MAINTAIN_INTERVAL ms.
+   -------------------------------------------------------------------------- */
+
+#define NET_MAINTAIN_INTERVAL 20                // ms between state machine steps
+#define NET_DHCP_RETRY 2000                     // Resend DISCOVER/REQUEST after this many ms...
+#define NET_DHCP_TIMEOUT 10000                  // ... and fall back to the static address after this many
+#define NET_DHCP_REBOOT 3000                    // Give up on the earlier address after this many ms
+#define NET_LEASE_MAX 604800UL                  // Treat longer (or infinite) leases as this many seconds
+
+// Network states
+enum NetworkState : uint8_t {
+    NET_START = 0,
+    NET_DISCOVER,
+    NET_REQUEST,
+    NET_BOUND,
+    NET_STATIC
+};
 
 // Function declarations
 
 void networkInit();
+void networkMaintain();
+bool networkUp();
+uint8_t networkState();
+void networkHint(const IPAddress& ip);
+bool networkLease(DhcpLease& lease);
 
 #endif
@@ -0,0 +1,127 @@
+/* =============================================================================
+   Payload.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "payload.h"
+
+PayloadWriter::PayloadWriter(char* buffer, uint16_t size) : _buffer(buffer), _size(size) {
+    reset();
+}
+
+void PayloadWriter::reset() {
+    _length = 0;
+    _overflow = false;
+    if (_size > 0) {
+        _buffer[0] = 0;
+    }
+}
+
+// Drops everything past "length", e.g. to undo a partial append
+void PayloadWriter::truncate(uint16_t length) {
+    if (length < _length) {
+        _length = length;
+        _buffer[_length] = 0;
+    }
+    _overflow = false;
+}
+
+bool PayloadWriter::append(char c) {
+    if (_length + 1 >= _size) {
+        _overflow = true;
+        return false;
+    }
+    _buffer[_length++] = c;
+    _buffer[_length] = 0;
+    return true;
+}
+
+bool PayloadWriter::append(const char* s) {
+    while (*s) {
+        if (!append(*s++)) return false;
+    }
+    return true;
+}
+
+bool PayloadWriter::append(const __FlashStringHelper* s) {
+    const char* p = reinterpret_cast<const char*>(s);
+    char c;
+    while ((c = pgm_read_byte(p++)) != 0) {
+        if (!append(c)) return false;
+    }
+    return true;
+}
+
+bool PayloadWriter::appendHex(uint8_t b) {
+    char hex[3];
+    hexByte(b, hex);
+    return append(hex);
+}
+
+bool PayloadWriter::appendInt(long value) {
+    char digits[11];
+    uint8_t n = 0;
+    unsigned long v;
+    if (value < 0) {
+        if (!append('-')) return false;
+        v = (unsigned long)(-(value + 1)) + 1;
+    } else {
+        v = (unsigned long)value;
+    }
+    do {
+        digits[n++] = '0' + (v % 10);
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) {
+        if (!append(digits[--n])) return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// APPENDFIXED
+// ---------------------------------------------------------------------------
+// Prints a fixed-point number without using floats.
+//
+// INPUTS:
+//    value          The number, scaled by 10^decimals (e.g. 2150 = 21.50)
+//    decimals       Number of digits after the decimal point
+// ---------------------------------------------------------------------------
+
+bool PayloadWriter::appendFixed(long value, uint8_t decimals) {
+    unsigned long scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+
+    unsigned long v;
+    if (value < 0) {
+        if (!append('-')) return false;
+        v = (unsigned long)(-(value + 1)) + 1;
+    } else {
+        v = (unsigned long)value;
+    }
+    if (!appendInt((long)(v / scale))) return false;
+    if (decimals == 0) return true;
+    if (!append('.')) return false;
+
+    unsigned long frac = v % scale;
+    while (scale > 1) {
+        scale /= 10;
+        if (!append('0' + (char)(frac / scale))) return false;
+        frac %= scale;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// HEXBYTE
+// ---------------------------------------------------------------------------
+// Writes the two uppercase hex digits of "b" plus a terminating NUL to "out".
+// ---------------------------------------------------------------------------
+
+void hexByte(uint8_t b, char* out) {
+    out[0] = ((b & 0xF0) >> 4) + 0x30;
+    if (out[0] > 0x39) out[0] += 0x07;
+    out[1] = (b & 0x0F) + 0x30;
+    if (out[1] > 0x39) out[1] += 0x07;
+    out[2] = 0x00;
+}
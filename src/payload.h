@@ -0,0 +1,45 @@
+/* =============================================================================
+   Payload.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_PAYLOAD_H
+#define __COMFOAIR_ARDUINO_PAYLOAD_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Fixed-buffer payload formatter
+   --------------------------------------------------------------------------
+   Writes "key=value" style text into a caller-provided buffer without any
+   heap allocation. The buffer is always NUL-terminated; once it runs full,
+   further appends are ignored and overflow() returns TRUE.
+   -------------------------------------------------------------------------- */
+
+class PayloadWriter {
+    public:
+        PayloadWriter(char* buffer, uint16_t size);
+
+        void reset();
+        void truncate(uint16_t length);
+        bool append(char c);
+        bool append(const char* s);
+        bool append(const __FlashStringHelper* s);
+        bool appendHex(uint8_t b);
+        bool appendInt(long value);
+        bool appendFixed(long value, uint8_t decimals);
+
+        const char* c_str() const               { return _buffer; }
+        uint16_t length() const                 { return _length; }
+        bool overflow() const                   { return _overflow; }
+
+    private:
+        char* _buffer;
+        uint16_t _size;
+        uint16_t _length;
+        bool _overflow;
+};
+
+void hexByte(uint8_t b, char* out);
+
+#endif
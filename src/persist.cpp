@@ -0,0 +1,400 @@
+/* =============================================================================
+   Persist.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "persist.h"
+
+#ifdef PERSIST_ENABLE
+
+#include <EEPROM.h>
+#include "commands.h"
+#include "decoder.h"
+#include "uart.h"
+#include "publish.h"
+#include "network.h"
+#include "stats.h"
+#include "payload.h"
+#include "mqtt.h"
+#include "log.h"
+
+extern ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
+
+// The EEPROM takes a byte at a time; the AVR core reads and writes wait for
+// the previous write to finish, so only start one when it has
+#if defined(__AVR__)
+#define PERSIST_READY() eeprom_is_ready()
+#else
+#define PERSIST_READY() true
+#endif
+
+/*=============================================================================
+   RECORD LAYOUT
+  ============================================================================= */
+
+// Header: magic, version, sequence number (2), CRC (2). The CRC covers
+// the whole record except itself and is seeded with the record size, so a
+// record of a build with other units or fields never passes.
+#define PERSIST_MAGIC 0xCA
+#define PERSIST_SEQAT 2
+#define PERSIST_CRCAT 4
+#define PERSIST_HEADERSIZE 6
+
+// Body: counters, the DHCP address (address, subnet, gateway, DNS), then
+// per unit a bitmap of the fields with a value and every value as 4 bytes.
+// Everything from the address on is the "state" that is checked for
+// changes; the counters change all the time.
+#define PERSIST_BITMAPSIZE ((CAFIELD_COUNT + 7) / 8)
+#define PERSIST_UNITSIZE (PERSIST_BITMAPSIZE + 4 * CAFIELD_COUNT)
+#define PERSIST_LEASESIZE 16
+#define PERSIST_STATEAT (PERSIST_HEADERSIZE + sizeof(PersistCounters))
+#define PERSIST_VALUESAT (PERSIST_STATEAT + PERSIST_LEASESIZE)
+#define PERSIST_RECORDSIZE (PERSIST_VALUESAT + ZEHNDER_UNITS * PERSIST_UNITSIZE)
+#define PERSIST_SLOTS (PERSIST_SIZE / PERSIST_RECORDSIZE)
+
+static_assert(PERSIST_SLOTS >= 2, "PERSIST_SIZE must hold at least two records");
+static_assert(PERSIST_SLOTS < 256, "Too many record slots");
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+// What persistMaintain() is doing
+enum PersistState : uint8_t {
+    PERSIST_IDLE = 0,
+    PERSIST_CHECK,                              // Computing the CRC of the state
+    PERSIST_WRITE                               // Writing a record
+};
+
+static uint8_t persistState = PERSIST_IDLE;
+static uint16_t persistAt;                      // Next byte to check or write
+static uint16_t persistCrc;                     // CRC of the record being written
+static uint16_t persistHash;                    // CRC of the state being checked or written
+static uint8_t persistWriteSlot;                // Slot being written
+
+static uint8_t persistSlot = PERSIST_SLOTS;     // Slot of the newest record (PERSIST_SLOTS: none)
+static uint16_t persistSeq = 0;                 // Its sequence number...
+static uint16_t persistStateCrc;                // ... and the CRC of its state
+
+static PersistCounters persistBase;             // Lifetime counters up to this boot (this boot included)
+static PersistCounters persistSnapshot;         // Counters of the record being written
+static uint8_t persistLease[PERSIST_LEASESIZE]; // Address to keep, from the lease or the last record
+static uint8_t persistRestored = 0;             // Field values restored on boot
+static uint8_t persistFlushing = 0xFF;          // Next unit to send the restored values of (0xFF: not connected yet)
+
+static unsigned long persistLastCheck = 0;      // millis() of the last look for changes
+static unsigned long persistLastWrite = 0;      // millis() of the last record
+static unsigned long persistLastTick = 0;       // millis() of the last uptime second
+static uint32_t persistSeconds = 0;             // Uptime (does not wrap like millis())
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// CRC-16 (polynomial 0xA001, as _crc16_update() in avr-libc)
+static uint16_t persistCrc16(uint16_t crc, uint8_t value) {
+    crc ^= value;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+    return crc;
+}
+
+static inline int persistAddress(uint8_t slot, uint16_t offset) {
+    return PERSIST_BASE + slot * PERSIST_RECORDSIZE + offset;
+}
+
+// ---------------------------------------------------------------------------
+// PERSISTBODY
+// ---------------------------------------------------------------------------
+// Byte "offset" of the record body as it is now: counters from the
+// snapshot, the address, and the values straight from the publish
+// scheduler, so nothing is built up in memory.
+// ---------------------------------------------------------------------------
+
+static uint8_t persistBody(uint16_t offset) {
+    if (offset < PERSIST_STATEAT) {
+        return ((const uint8_t*)&persistSnapshot)[offset - PERSIST_HEADERSIZE];
+    }
+    if (offset < PERSIST_VALUESAT) {
+        return persistLease[offset - PERSIST_STATEAT];
+    }
+    offset -= PERSIST_VALUESAT;
+    uint8_t unit = offset / PERSIST_UNITSIZE;
+    offset %= PERSIST_UNITSIZE;
+    long value;
+    if (offset < PERSIST_BITMAPSIZE) {
+        uint8_t bitmap = 0;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            uint8_t index = offset * 8 + bit;
+            if (index < CAFIELD_COUNT && publishLatest(unit, index, value)) bitmap |= (1 << bit);
+        }
+        return bitmap;
+    }
+    offset -= PERSIST_BITMAPSIZE;
+    if (!publishLatest(unit, offset / 4, value)) {
+        return 0;
+    }
+    return (uint8_t)((uint32_t)value >> (8 * (offset % 4)));
+}
+
+// ---------------------------------------------------------------------------
+// PERSISTVALID
+// ---------------------------------------------------------------------------
+// Checks the record in a slot.
+//
+// OUTPUTS:
+//    bool           TRUE if the record is intact, with its sequence number
+//                   and the CRC of its state
+// ---------------------------------------------------------------------------
+
+static bool persistValid(uint8_t slot, uint16_t& seq, uint16_t& hash) {
+    if (EEPROM.read(persistAddress(slot, 0)) != PERSIST_MAGIC ||
+        EEPROM.read(persistAddress(slot, 1)) != PERSIST_VERSION) {
+        return false;
+    }
+    uint16_t crc = PERSIST_RECORDSIZE;
+    hash = 0xFFFF;
+    for (uint16_t offset = 0; offset < PERSIST_RECORDSIZE; offset++) {
+        if (offset == PERSIST_CRCAT) offset += 2;
+        uint8_t value = EEPROM.read(persistAddress(slot, offset));
+        crc = persistCrc16(crc, value);
+        if (offset >= PERSIST_STATEAT) hash = persistCrc16(hash, value);
+    }
+    seq = EEPROM.read(persistAddress(slot, PERSIST_SEQAT)) | (EEPROM.read(persistAddress(slot, PERSIST_SEQAT + 1)) << 8);
+    return crc == (EEPROM.read(persistAddress(slot, PERSIST_CRCAT)) |
+                   (EEPROM.read(persistAddress(slot, PERSIST_CRCAT + 1)) << 8));
+}
+
+// ---------------------------------------------------------------------------
+// PERSISTINIT
+// ---------------------------------------------------------------------------
+// Call from setup(), before the network starts: finds the newest intact
+// record and takes over its counters, address and values.
+// ---------------------------------------------------------------------------
+
+void persistInit() {
+    for (uint8_t slot = 0; slot < PERSIST_SLOTS; slot++) {
+        uint16_t seq, hash;
+        if (!persistValid(slot, seq, hash)) continue;
+        if (persistSlot == PERSIST_SLOTS || (int16_t)(seq - persistSeq) > 0) {
+            persistSlot = slot;
+            persistSeq = seq;
+            persistStateCrc = hash;
+        }
+    }
+
+    memset(&persistBase, 0, sizeof(persistBase));
+    if (persistSlot == PERSIST_SLOTS) {
+        LOG_INFOLN(F("Persist: no record, cold start"));
+        persistBase.boots = 1;
+        return;
+    }
+
+    uint8_t* counters = (uint8_t*)&persistBase;
+    for (uint16_t i = 0; i < sizeof(persistBase); i++) {
+        counters[i] = EEPROM.read(persistAddress(persistSlot, PERSIST_HEADERSIZE + i));
+    }
+    persistBase.boots++;
+    for (uint8_t i = 0; i < PERSIST_LEASESIZE; i++) {
+        persistLease[i] = EEPROM.read(persistAddress(persistSlot, PERSIST_STATEAT + i));
+    }
+    if (persistLease[0] != 0) {
+        networkHint(IPAddress(persistLease));
+    }
+
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        uint16_t at = PERSIST_VALUESAT + unit * PERSIST_UNITSIZE;
+        for (uint8_t index = 0; index < CAFIELD_COUNT; index++) {
+            if (!(EEPROM.read(persistAddress(persistSlot, at + index / 8)) & (1 << (index % 8)))) continue;
+            uint32_t value = 0;
+            for (uint8_t i = 4; i-- > 0; ) {
+                value = (value << 8) | EEPROM.read(persistAddress(persistSlot, at + PERSIST_BITMAPSIZE + 4 * index + i));
+            }
+            publishRestore(unit, index, (long)value);
+            persistRestored++;
+        }
+    }
+    LOG_INFO(F("Persist: warm start from record "));
+    LOG_INFO(persistSeq);
+    LOG_INFO(F(", values restored: "));
+    LOG_INFOLN(persistRestored);
+}
+
+// Lifetime counters: the ones from EEPROM plus the ones since boot
+void persistTotals(PersistCounters& totals) {
+    totals = persistBase;
+    totals.uptime += persistSeconds;
+#ifdef STATS_ENABLE
+    totals.published += systemStats.published;
+#endif
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        const CADecoderStats& decoder = zehnderDecoders[unit].stats();
+        UartStats uart = zehnderUarts[unit]->stats();
+        PersistUnitCounters& counters = totals.units[unit];
+        counters.rx += uart.bytes;
+        counters.frames += decoder.frames;
+        counters.crc += decoder.checksumErrors;
+        counters.framing += decoder.framingErrors;
+        counters.overflows += (uint32_t)uart.overflows + uart.overruns;
+    }
+}
+
+// Reports the restore once the broker is connected
+static void persistReport() {
+    PayloadWriter msg(mqttPayload, sizeof(mqttPayload));
+    msg.append(F("command=05 boots="));
+    msg.appendInt(persistBase.boots);
+    msg.append(F(" restored="));
+    msg.appendInt(persistRestored);
+    msg.append(F(" seq="));
+    msg.appendInt(persistRestored ? persistSeq : 0);
+    mqttPublishSystem(msg.c_str(), msg.length());
+    persistFlushing = persistRestored ? 0 : ZEHNDER_UNITS;
+}
+
+// Starts writing the next slot: the counters are taken now, the rest is
+// read as it is written
+static void persistStartWrite() {
+    persistTotals(persistSnapshot);
+    persistWriteSlot = (persistSlot == PERSIST_SLOTS) ? 0 : (persistSlot + 1) % PERSIST_SLOTS;
+    persistSeq++;
+    persistCrc = PERSIST_RECORDSIZE;
+    persistCrc = persistCrc16(persistCrc, PERSIST_MAGIC);
+    persistCrc = persistCrc16(persistCrc, PERSIST_VERSION);
+    persistCrc = persistCrc16(persistCrc, (uint8_t)persistSeq);
+    persistCrc = persistCrc16(persistCrc, (uint8_t)(persistSeq >> 8));
+    persistHash = 0xFFFF;
+    persistAt = PERSIST_HEADERSIZE;
+    persistState = PERSIST_WRITE;
+}
+
+// Byte of the record at "offset" during a write; the header comes last,
+// when the CRC is complete
+static uint8_t persistWriteValue(uint16_t offset) {
+    switch (offset) {
+        case 0:                     return PERSIST_MAGIC;
+        case 1:                     return PERSIST_VERSION;
+        case PERSIST_SEQAT:         return (uint8_t)persistSeq;
+        case PERSIST_SEQAT + 1:     return (uint8_t)(persistSeq >> 8);
+        case PERSIST_CRCAT:         return (uint8_t)persistCrc;
+        case PERSIST_CRCAT + 1:     return (uint8_t)(persistCrc >> 8);
+        default:                    return persistBody(offset);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PERSISTWRITE
+// ---------------------------------------------------------------------------
+// Next step of a write: compares up to PERSIST_CHUNK bytes with the EEPROM
+// and writes the first one that differs. Order: body, CRC, header.
+// ---------------------------------------------------------------------------
+
+static void persistWrite() {
+    if (!PERSIST_READY()) {
+        return;
+    }
+    for (uint8_t n = 0; n < PERSIST_CHUNK; n++) {
+        uint16_t offset;
+        if (persistAt >= PERSIST_HEADERSIZE) {
+            offset = persistAt;
+        } else {
+            // Past the body, persistAt runs 0..5 again: CRC first, then the rest of the header
+            offset = (persistAt + PERSIST_CRCAT) % PERSIST_HEADERSIZE;
+        }
+        uint8_t value = persistWriteValue(offset);
+        if (offset >= PERSIST_HEADERSIZE) {
+            persistCrc = persistCrc16(persistCrc, value);
+            if (offset >= PERSIST_STATEAT) persistHash = persistCrc16(persistHash, value);
+        }
+
+        persistAt++;
+        if (persistAt == PERSIST_RECORDSIZE) {
+            persistAt = 0;
+        } else if (persistAt == PERSIST_HEADERSIZE && offset < PERSIST_HEADERSIZE) {
+            // Header complete: this is now the newest record
+            persistSlot = persistWriteSlot;
+            persistStateCrc = persistHash;
+            persistLastWrite = millis();
+            persistState = PERSIST_IDLE;
+            LOG_DEBUG(F("Persist: record "));
+            LOG_DEBUG(persistSeq);
+            LOG_DEBUG(F(" in slot "));
+            LOG_DEBUGLN(persistSlot);
+        }
+
+        int address = persistAddress(persistWriteSlot, offset);
+        if (EEPROM.read(address) != value) {
+            EEPROM.write(address, value);
+            return;                             // Busy for a while now
+        }
+        if (persistState != PERSIST_WRITE) {
+            return;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PERSISTMAINTAIN
+// ---------------------------------------------------------------------------
+// Loop task: reports the restore and sends the restored values once the
+// broker is connected, looks for changes every PERSIST_INTERVAL and writes
+// a record step by step.
+// ---------------------------------------------------------------------------
+
+void persistMaintain() {
+    unsigned long now = millis();
+    while (now - persistLastTick >= 1000) {
+        persistLastTick += 1000;
+        persistSeconds++;
+    }
+    if (persistFlushing == 0xFF && mqttConnected()) {
+        persistReport();
+    } else if (persistFlushing < ZEHNDER_UNITS && mqttQueueUsed() == 0) {
+        // Send the restored values, marked stale, a unit at a time so they
+        // do not push each other out of the queue
+        publishStaleUnit(persistFlushing++);
+    }
+
+    switch (persistState) {
+        case PERSIST_IDLE:
+            if (now - persistLastCheck >= PERSIST_INTERVAL) {
+                persistLastCheck = now;
+                DhcpLease lease;
+                if (networkLease(lease)) {
+                    for (uint8_t i = 0; i < 4; i++) {
+                        persistLease[i] = lease.ip[i];
+                        persistLease[4 + i] = lease.subnet[i];
+                        persistLease[8 + i] = lease.gateway[i];
+                        persistLease[12 + i] = lease.dns[i];
+                    }
+                }
+                persistHash = 0xFFFF;
+                persistAt = PERSIST_STATEAT;
+                persistState = PERSIST_CHECK;
+            }
+            break;
+
+        case PERSIST_CHECK:
+            // No EEPROM access here, so a few chunks at a time
+            for (uint8_t n = 0; n < 4 * PERSIST_CHUNK && persistAt < PERSIST_RECORDSIZE; n++) {
+                persistHash = persistCrc16(persistHash, persistBody(persistAt++));
+            }
+            if (persistAt < PERSIST_RECORDSIZE) {
+                break;
+            }
+            if (persistSlot == PERSIST_SLOTS || persistHash != persistStateCrc ||
+                now - persistLastWrite >= PERSIST_REFRESH) {
+                persistStartWrite();
+            } else {
+                persistState = PERSIST_IDLE;
+            }
+            break;
+
+        case PERSIST_WRITE:
+            persistWrite();
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* =============================================================================
+   Persist.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_PERSIST_H
+#define __COMFOAIR_ARDUINO_PERSIST_H
+
+#include <Arduino.h>
+#include "zehnder.h"
+
+/* --------------------------------------------------------------------------
+   Warm start
+   --------------------------------------------------------------------------
+   The last decoded value of every field, a set of lifetime counters and
+   the DHCP address are kept in EEPROM, so a restart (power cut, reset,
+   firmware update) does not begin with nothing:
+
+   - On boot, the values are handed to the publish scheduler as the last
+     known state, marked stale (see publish.h): they are in /values right
+     away, counted under "stale", and go out once on each unit's stale
+     topic as soon as the broker is connected:
+
+        MQTTPUBTOPIC_STALE   command=D2 t_comfort=21.50,t1_intake=8.00; ...
+
+     They never appear on the data topic, and the first decoded value of a
+     field is always published. They are as old as the last record, up to
+     PERSIST_INTERVAL before the restart.
+   - The network asks the DHCP server for the address it had before,
+     instead of discovering from scratch (INIT-REBOOT, see network.h).
+   - The counters carry on: /stats shows them as "lifetime".
+   - Once the broker is connected for the first time, unit 0 reports on
+     its system topic:
+
+        command=05 boots=12 restored=37 seq=4711
+
+     boots      Starts of the board, this one included
+     restored   Field values taken over from EEPROM (all units together)
+     seq        Sequence number of the record they came from (0: none)
+
+   The record is written in turn to PERSIST_SLOTS places in EEPROM. Each
+   copy carries a sequence number and a CRC; on boot, the valid copy with
+   the highest sequence number is used, so a write cut short by a reset
+   only loses that write.
+
+   Writing never blocks: persistMaintain() compares PERSIST_CHUNK bytes
+   per run and writes at most one that differs, and only once the EEPROM
+   has finished the previous one (3.3 ms on the AVR). The body goes first,
+   then the CRC, then the header that makes the copy valid.
+
+   Every PERSIST_INTERVAL, the values and the address are compared (by
+   CRC) with what was written last. A new record is written only when they
+   changed, or after PERSIST_REFRESH to bring the counters up to date. At
+   most 4 records an hour spread over the slots, a byte is written some
+   5000 times a year with 7 slots (3 units, 553 bytes a record; 19 slots
+   and 1800 times with 1 unit), against 100000 rated cycles.
+   -------------------------------------------------------------------------- */
+
+#define PERSIST_ENABLE                          // Comment out to start from nothing after every restart
+#define PERSIST_BASE 0                          // First EEPROM address used
+#define PERSIST_SIZE 4096                       // EEPROM bytes used from there (the Mega 2560 has 4096)
+#define PERSIST_INTERVAL 900000UL               // Look for changes every this many ms...
+#define PERSIST_REFRESH 21600000UL              // ... and write the counters at least every this many
+#define PERSIST_CHUNK 16                        // Bytes compared per persistMaintain() call
+#define PERSIST_VERSION 1                       // Record layout
+
+// Lifetime counters of one unit (see stats.h for their meaning)
+struct PersistUnitCounters {
+    uint32_t rx;
+    uint32_t frames;
+    uint32_t crc;
+    uint32_t framing;
+    uint32_t overflows;
+};
+
+// Lifetime counters: every restart adds what was counted since boot
+struct PersistCounters {
+    uint32_t boots;                             // Starts of the board
+    uint32_t uptime;                            // Seconds running
+    uint32_t published;                         // Successful MQTT publishes
+    PersistUnitCounters units[ZEHNDER_UNITS];
+};
+
+#ifdef PERSIST_ENABLE
+
+// Function declarations
+void persistInit();
+void persistMaintain();
+void persistTotals(PersistCounters& totals);
+
+#endif
+
+#endif
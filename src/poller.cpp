@@ -0,0 +1,183 @@
+/* =============================================================================
+   Poller.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "poller.h"
+#include "decoder.h"
+#include "uart.h"
+#include "control.h"
+#include "bus.h"
+#include "log.h"
+
+extern ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
+
+/*=============================================================================
+   POLLING PLAN
+  ============================================================================= */
+
+static const PollEntry pollPlan[POLL_COUNT] PROGMEM = {
+    { 0xD1, 10 },                               // Temperatures
+    { 0x0B, 10 },                               // Ventilator status
+    { 0x0D, 60 },                               // Valve status
+    { 0xCD, 60 },                               // Ventilation levels
+    { 0xDF, 60 },                               // Bypass control
+    { 0x11, 60 },                               // Temperature status
+    { 0xD9, 300 },                              // Faults / filter
+    { 0xDD, 300 }                               // Operating hours
+};
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+// Polling state of one unit
+struct PollUnit {
+    unsigned long due[POLL_COUNT];              // millis() at which each entry is due (0 = now)
+    uint8_t pending;                            // Entry waiting for a reply (POLL_COUNT = none)
+    uint8_t expired;                            // Entry last given up on, to recognise its late reply
+    unsigned long sent;                         // millis() when the pending request was sent
+    PollStats counters;
+
+    PollUnit() : pending(POLL_COUNT), expired(POLL_COUNT) {}         // Everything else starts at zero (static storage)
+};
+
+static PollUnit pollUnits[ZEHNDER_UNITS];
+static bool pollSuspended = false;              // No requests, only writes (see pollSuspend())
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// Command byte of the reply to an entry of the plan
+static uint8_t pollReply(uint8_t entry) {
+    return pgm_read_byte(&pollPlan[entry].command) + 1;
+}
+
+// ---------------------------------------------------------------------------
+// POLLSEND
+// ---------------------------------------------------------------------------
+// Uses the line of a unit for a queued write or, if there is none, sends
+// the request of the most overdue entry in the plan.
+// ---------------------------------------------------------------------------
+
+static void pollSend(uint8_t unit) {
+    if (controlSend(unit)) {
+        return;
+    }
+#ifdef POLL_ENABLE
+    if (pollSuspended) {
+        return;
+    }
+    PollUnit& poll = pollUnits[unit];
+    unsigned long now = millis();
+    uint8_t next = POLL_COUNT;
+    unsigned long lateness = 0;
+    for (uint8_t i = 0; i < POLL_COUNT; i++) {
+        if ((long)(now - poll.due[i]) >= 0 && (next == POLL_COUNT || now - poll.due[i] > lateness)) {
+            next = i;
+            lateness = now - poll.due[i];
+        }
+    }
+    if (next == POLL_COUNT) {
+        return;
+    }
+
+    PollEntry entry;
+    memcpy_P(&entry, &pollPlan[next], sizeof(entry));
+    byte frame[CADEC_WIRESIZE(0)];
+    uint16_t size = caEncodeFrame(entry.command, NULL, 0, frame);
+    if (!zehnderUarts[unit]->write(frame, size)) {
+        return;                                 // Transmitter busy; try again next loop
+    }
+#ifdef BUS_ENABLE
+    busSent(unit, entry.command, 0, size);
+#endif
+    poll.due[next] = now + (unsigned long)entry.interval * 1000UL;
+    poll.pending = next;
+    poll.sent = now;
+    poll.counters.requests++;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// POLLUNIT
+// ---------------------------------------------------------------------------
+// Expires an unanswered request of a unit and starts a new exchange once
+// its line has been quiet long enough.
+// ---------------------------------------------------------------------------
+
+static void pollUnit(uint8_t unit) {
+    PollUnit& poll = pollUnits[unit];
+    ZehnderUart& uart = *zehnderUarts[unit];
+    unsigned long now = millis();
+    if (poll.pending < POLL_COUNT) {
+        if (now - poll.sent < POLL_TIMEOUT) {
+            return;
+        }
+        LOG_WARN(F("Poll timeout: 0x"));
+        LOG_WARNLN(pgm_read_byte(&pollPlan[poll.pending].command), HEX);
+        poll.counters.timeouts++;
+        poll.expired = poll.pending;
+        poll.pending = POLL_COUNT;
+    }
+
+    // A write waiting for its ACK, or somebody else may be talking
+    if (controlBusy(unit) || uart.sending() || uart.available() || !zehnderDecoders[unit].idle()) {
+        return;
+    }
+    if (now - uart.lastReceive() < POLL_QUIETGAP) {
+        return;
+    }
+    pollSend(unit);
+}
+
+// Call from loop(): serves the line of every unit
+void pollMaintain() {
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        pollUnit(unit);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// POLLFRAME
+// ---------------------------------------------------------------------------
+// Call for every decoded frame. If it answers our pending request, the
+// reply is acknowledged and the next due request follows immediately: the
+// line is still ours. A reply has to come from the line of the unit we
+// asked, within POLL_TIMEOUT of the request.
+//
+// INPUTS:
+//    unit           Unit the frame came from
+//    command        Command byte of the frame that was just decoded
+// ---------------------------------------------------------------------------
+
+void pollFrame(uint8_t unit, uint8_t command) {
+    if (unit >= ZEHNDER_UNITS) {
+        return;
+    }
+    PollUnit& poll = pollUnits[unit];
+    // Past POLL_TIMEOUT the request is given up on (pollUnit() counts it);
+    // its reply must not take the line for a new exchange
+    if (poll.pending < POLL_COUNT && command == pollReply(poll.pending) && millis() - poll.sent < POLL_TIMEOUT) {
+        poll.counters.replies++;
+        poll.pending = POLL_COUNT;
+        poll.expired = POLL_COUNT;
+        zehnderUarts[unit]->write(cacmd_AckCMD, sizeof(cacmd_AckCMD));
+        pollSend(unit);
+    } else if (poll.pending < POLL_COUNT && command == pollReply(poll.pending)) {
+        poll.counters.late++;
+    } else if (poll.expired < POLL_COUNT && command == pollReply(poll.expired)) {
+        poll.counters.late++;
+        poll.expired = POLL_COUNT;
+    }
+}
+
+// Stops (TRUE) or resumes (FALSE) sending requests; queued writes still go out
+void pollSuspend(bool suspend) {
+    pollSuspended = suspend;
+}
+
+const PollStats& pollStats(uint8_t unit) {
+    return pollUnits[unit].counters;
+}
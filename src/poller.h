@@ -0,0 +1,62 @@
+/* =============================================================================
+   Poller.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_POLLER_H
+#define __COMFOAIR_ARDUINO_POLLER_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Active polling
+   --------------------------------------------------------------------------
+   Instead of waiting for the panel to ask, we request data ourselves. Every
+   command in the polling plan (pollPlan[] in poller.cpp) is requested once
+   its interval expires. The unit replies with the request command + 1,
+   which is decoded like any other frame and acknowledged by us (07 F3).
+
+   Only one request is outstanding at a time. As soon as its reply arrives
+   (on that unit's line, within POLL_TIMEOUT), the next due request goes
+   out right behind our acknowledge. Starting a
+   new exchange requires the decoder to be between frames and the line to
+   have been quiet for POLL_QUIETGAP ms, so we do not talk over the panel.
+
+   The poller decides when we may talk on the line at all: writes queued
+   by control.cpp are offered the line first, and no request is sent while
+   a write waits for its ACK. This also applies when POLL_ENABLE is not
+   defined and no polling requests are sent.
+
+   pollSuspend() stops the requests at run time, e.g. while the traffic of
+   an earlier session is played back to us (which has its own requests
+   and replies in it).
+
+   Every unit (see ZEHNDER_UNITS) runs through the plan on its own line.
+   -------------------------------------------------------------------------- */
+
+#define POLL_ENABLE                             // Comment out to only listen (and write)
+#define POLL_COUNT 8                            // Number of rows in pollPlan[]
+#define POLL_TIMEOUT 500                        // Give up on a reply after this many ms
+#define POLL_QUIETGAP 20                        // Required silence before we start talking (ms, ~19 bytes)
+
+// Polling plan entry
+struct PollEntry {
+    uint8_t command;                            // Request command byte
+    uint16_t interval;                          // Seconds between requests
+};
+
+// Poller counters
+struct PollStats {
+    uint32_t requests;                          // Requests sent
+    uint32_t replies;                           // Matching replies received
+    uint16_t timeouts;                          // Requests that were not answered in time
+    uint16_t late;                              // Replies that came after the timeout (not acknowledged)
+};
+
+// Function declarations
+void pollMaintain();
+void pollFrame(uint8_t unit, uint8_t command);
+void pollSuspend(bool suspend);
+const PollStats& pollStats(uint8_t unit);
+
+#endif
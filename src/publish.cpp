@@ -0,0 +1,391 @@
+/* =============================================================================
+   Publish.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "publish.h"
+#include "commands.h"
+#include "payload.h"
+#include "mqtt.h"
+#include "zehnder.h"
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+// Field state of one unit
+struct PublishUnit {
+    // Samples collected during the current window
+    long sample[CAFIELD_COUNT];                     // Last sample
+    uint8_t pending[(CAFIELD_COUNT + 7) / 8];       // Bitmap: sampled in this window
+    uint8_t sampled[(CAFIELD_COUNT + 7) / 8];       // Bitmap: sample[] holds a value
+    uint8_t stale[(CAFIELD_COUNT + 7) / 8];         // Bitmap: sample[] was restored, not decoded
+#ifdef PUBLISH_AGGREGATE
+    long min[CAFIELD_COUNT];
+    long max[CAFIELD_COUNT];
+    long sum[CAFIELD_COUNT];
+    uint8_t count[CAFIELD_COUNT];
+#endif
+
+    // Last published value of every field in the command registry
+    long cache[CAFIELD_COUNT];
+    uint16_t published[CAFIELD_COUNT];              // Time of last publish (seconds, wraps)
+    uint8_t valid[(CAFIELD_COUNT + 7) / 8];         // Bitmap: field was published before
+};
+
+static PublishUnit publishUnits[ZEHNDER_UNITS];
+
+unsigned long lastFlush = 0;
+static uint8_t publishFlushing = ZEHNDER_UNITS; // Next unit of the window flush (ZEHNDER_UNITS = none)
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+static inline bool bitmapGet(const uint8_t* bitmap, uint8_t index) {
+    return bitmap[index >> 3] & (1 << (index & 7));
+}
+
+static inline void bitmapSet(uint8_t* bitmap, uint8_t index, bool value) {
+    if (value) {
+        bitmap[index >> 3] |= (1 << (index & 7));
+    } else {
+        bitmap[index >> 3] &= ~(1 << (index & 7));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PUBLISHSAMPLE
+// ---------------------------------------------------------------------------
+// Records a freshly decoded field value for the current window.
+//
+// INPUTS:
+//    unit           Unit the value came from
+//    index          Row of the field in caFields[]
+//    value          Raw decoded value
+// ---------------------------------------------------------------------------
+
+void publishSample(uint8_t unit, uint8_t index, long value) {
+    PublishUnit& fields = publishUnits[unit];
+#ifdef PUBLISH_AGGREGATE
+    if (!bitmapGet(fields.pending, index) || (fields.count[index] == 0xFF)) {
+        fields.min[index] = value;
+        fields.max[index] = value;
+        fields.sum[index] = 0;
+        fields.count[index] = 0;
+    }
+    if (value < fields.min[index]) fields.min[index] = value;
+    if (value > fields.max[index]) fields.max[index] = value;
+    fields.sum[index] += value;
+    fields.count[index]++;
+#endif
+    fields.sample[index] = value;
+    bitmapSet(fields.pending, index, true);
+    bitmapSet(fields.sampled, index, true);
+    bitmapSet(fields.stale, index, false);
+}
+
+// ---------------------------------------------------------------------------
+// PUBLISHRESTORE
+// ---------------------------------------------------------------------------
+// Takes over a value restored from EEPROM (see persist.h) as the latest
+// value of a field, marked stale until the field is decoded again. It is
+// not a sample: it does not go out with the window and the deadband still
+// compares the first decoded value against nothing.
+//
+// INPUTS:
+//    unit           Unit the value belongs to
+//    index          Row of the field in caFields[]
+//    value          Raw value from the record
+// ---------------------------------------------------------------------------
+
+void publishRestore(uint8_t unit, uint8_t index, long value) {
+    PublishUnit& fields = publishUnits[unit];
+#ifdef PUBLISH_AGGREGATE
+    fields.min[index] = value;
+    fields.max[index] = value;
+#endif
+    fields.sample[index] = value;
+    bitmapSet(fields.sampled, index, true);
+    bitmapSet(fields.stale, index, true);
+}
+
+// Latest decoded value of a field, whether it was published or not;
+// FALSE if the field was never decoded
+bool publishLatest(uint8_t unit, uint8_t index, long& value) {
+    const PublishUnit& fields = publishUnits[unit];
+    if (!bitmapGet(fields.sampled, index)) {
+        return false;
+    }
+    value = fields.sample[index];
+    return true;
+}
+
+// Number of fields of a unit that still hold a restored value
+uint8_t publishStale(uint8_t unit) {
+    const PublishUnit& fields = publishUnits[unit];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < CAFIELD_COUNT; i++) {
+        if (bitmapGet(fields.stale, i)) count++;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// FIELDDUE
+// ---------------------------------------------------------------------------
+// Compares a field against the last published value: it is due when it
+// moved more than its deadband, or when the heartbeat expired.
+// ---------------------------------------------------------------------------
+
+static bool fieldDue(const PublishUnit& fields, uint8_t index, long value, uint8_t deadband, uint16_t now) {
+    if (!bitmapGet(fields.valid, index)) {
+        return true;
+    }
+    long delta = value - fields.cache[index];
+    if (delta < 0) delta = -delta;
+    return (delta > deadband) || ((uint16_t)(now - fields.published[index]) >= PUBLISH_HEARTBEAT);
+}
+
+#ifdef PUBLISH_FIELDS
+
+// Publishes one field, retained, on its own topic
+static void publishField(uint8_t unit, PayloadWriter& payload, const CAField& field, uint8_t index, long value) {
+    payload.reset();
+    caAppendValue(payload, field, value);
+#ifdef PUBLISH_AGGREGATE
+    const PublishUnit& fields = publishUnits[unit];
+    payload.append('/');
+    caAppendValue(payload, field, fields.min[index]);
+    payload.append('/');
+    caAppendValue(payload, field, fields.max[index]);
+#endif
+    mqttPublishField(index, payload.c_str(), payload.length(), unit);
+}
+
+#elif defined(PUBLISH_BINARY)
+
+// Payload length of a message without any fields
+#define PUBLISH_EMPTY PUBLISH_BINARY_HEADERSIZE
+
+// Position of the open group's field count in mqttPayload
+static uint16_t groupCountAt;
+
+// Starts a new message with the binary header
+static void openMessage(PayloadWriter& payload) {
+    payload.reset();
+    payload.append('C');
+    payload.append('T');
+    payload.append((char)PUBLISH_BINARY_VERSION);
+#ifdef PUBLISH_AGGREGATE
+    payload.append((char)PUBLISH_FLAG_AGGREGATE);
+#else
+    payload.append((char)0);
+#endif
+}
+
+// Appends a raw value in "width" bytes, big endian as on the bus
+static void appendRaw(PayloadWriter& payload, long value, uint8_t width) {
+    while (width-- > 0) {
+        payload.append((char)((value >> (8 * width)) & 0xFF));
+    }
+}
+
+// Appends one field, opening a new command group when needed
+static void appendField(const PublishUnit& fields, PayloadWriter& payload, const CAField& field, uint8_t index, long value, uint8_t& group) {
+    if (group != field.command) {
+        payload.append((char)field.command);
+        groupCountAt = payload.length();
+        payload.append((char)0);
+        group = field.command;
+    }
+    payload.append((char)field.offset);
+    appendRaw(payload, value, field.width);
+#ifdef PUBLISH_AGGREGATE
+    appendRaw(payload, fields.min[index], field.width);
+    appendRaw(payload, fields.max[index], field.width);
+#else
+    (void)fields;
+    (void)index;
+#endif
+    if (!payload.overflow()) {
+        mqttPayload[groupCountAt]++;
+    }
+}
+
+#else
+
+// Payload length of a message without any fields
+#define PUBLISH_EMPTY 0
+
+static void openMessage(PayloadWriter& payload) {
+    payload.reset();
+}
+
+// Appends one field, opening a new "command=XX" group when needed
+static void appendField(const PublishUnit& fields, PayloadWriter& payload, const CAField& field, uint8_t index, long value, uint8_t& group) {
+    if (group != field.command) {
+        if (payload.length() > 0) payload.append(F("; "));
+        payload.append(F("command="));
+        payload.appendHex(field.command);
+        payload.append(' ');
+        group = field.command;
+    } else {
+        payload.append(',');
+    }
+    caAppendKey(payload, field);
+    payload.append('=');
+    caAppendValue(payload, field, value);
+#ifdef PUBLISH_AGGREGATE
+    payload.append('/');
+    caAppendValue(payload, field, fields.min[index]);
+    payload.append('/');
+    caAppendValue(payload, field, fields.max[index]);
+#else
+    (void)fields;
+    (void)index;
+#endif
+}
+
+#endif
+
+// ---------------------------------------------------------------------------
+// PUBLISHUNIT
+// ---------------------------------------------------------------------------
+// Sends everything of a unit that is due from the current window, packing
+// as many fields per message as MQTT_MAX_PAYLOAD_SIZE allows. With
+// PUBLISH_FIELDS, every field is a message of its own.
+//
+// OUTPUTS:
+//    uint8_t        Number of messages sent
+// ---------------------------------------------------------------------------
+
+static uint8_t publishUnit(uint8_t unit, uint16_t now) {
+    PublishUnit& fields = publishUnits[unit];
+    PayloadWriter payload(mqttPayload, sizeof(mqttPayload));
+    uint8_t group = 0;
+    uint8_t messages = 0;
+    CAField field;
+
+#ifndef PUBLISH_FIELDS
+    openMessage(payload);
+#endif
+    for (uint8_t i = 0; i < CAFIELD_COUNT; i++) {
+        if (!bitmapGet(fields.pending, i)) continue;
+        bitmapSet(fields.pending, i, false);
+
+        caReadField(i, field);
+#ifdef PUBLISH_AGGREGATE
+        long value = (fields.sum[i] + fields.count[i] / 2) / fields.count[i];
+#else
+        long value = fields.sample[i];
+#endif
+        if (!fieldDue(fields, i, value, field.deadband, now)) continue;
+
+#ifdef PUBLISH_FIELDS
+        publishField(unit, payload, field, i, value);
+        messages++;
+        (void)group;
+#else
+        uint16_t mark = payload.length();
+        appendField(fields, payload, field, i, value, group);
+        if (payload.overflow()) {
+            // Message full: send what we have and continue in a new one
+            payload.truncate(mark);
+            mqttPublishData(payload.c_str(), payload.length(), unit);
+            messages++;
+            openMessage(payload);
+            group = 0;
+            appendField(fields, payload, field, i, value, group);
+        }
+#endif
+
+        bitmapSet(fields.valid, i, true);
+        fields.cache[i] = value;
+        fields.published[i] = now;
+    }
+
+#ifndef PUBLISH_FIELDS
+    if (payload.length() > PUBLISH_EMPTY) {
+        mqttPublishData(payload.c_str(), payload.length(), unit);
+        messages++;
+    }
+#endif
+    return messages;
+}
+
+// ---------------------------------------------------------------------------
+// PUBLISHSTALEUNIT
+// ---------------------------------------------------------------------------
+// Sends the values of a unit that were restored from EEPROM and not decoded
+// since, on its stale topic, in the layout of the data topic. With
+// PUBLISH_FIELDS nothing is sent: the retained field topics still hold
+// these values at the broker.
+//
+// OUTPUTS:
+//    uint8_t        Number of messages sent
+// ---------------------------------------------------------------------------
+
+uint8_t publishStaleUnit(uint8_t unit) {
+#ifdef PUBLISH_FIELDS
+    (void)unit;
+    return 0;
+#else
+    const PublishUnit& fields = publishUnits[unit];
+    PayloadWriter payload(mqttPayload, sizeof(mqttPayload));
+    uint8_t group = 0;
+    uint8_t messages = 0;
+    CAField field;
+
+    openMessage(payload);
+    for (uint8_t i = 0; i < CAFIELD_COUNT; i++) {
+        if (!bitmapGet(fields.stale, i)) continue;
+        caReadField(i, field);
+        uint16_t mark = payload.length();
+        appendField(fields, payload, field, i, fields.sample[i], group);
+        if (payload.overflow()) {
+            payload.truncate(mark);
+            mqttPublishStale(payload.c_str(), payload.length(), unit);
+            messages++;
+            openMessage(payload);
+            group = 0;
+            appendField(fields, payload, field, i, fields.sample[i], group);
+        }
+    }
+    if (payload.length() > PUBLISH_EMPTY) {
+        mqttPublishStale(payload.c_str(), payload.length(), unit);
+        messages++;
+    }
+    return messages;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// PUBLISHFLUSH
+// ---------------------------------------------------------------------------
+// Ends the current window: from the next publishMaintain() on, everything
+// that is due is sent, one unit per call.
+// ---------------------------------------------------------------------------
+
+void publishFlush() {
+    lastFlush = millis();
+    publishFlushing = 0;
+}
+
+// ---------------------------------------------------------------------------
+// PUBLISHMAINTAIN
+// ---------------------------------------------------------------------------
+// Called from loop(): flushes the window once it has expired. A unit's part
+// only goes out once the MQTT queue is empty, so it always has room for it;
+// until then, its samples stay in the window.
+// ---------------------------------------------------------------------------
+
+void publishMaintain() {
+    if (publishFlushing < ZEHNDER_UNITS) {
+        if (mqttQueueUsed() == 0) {
+            publishUnit(publishFlushing++, (uint16_t)(millis() / 1000));
+        }
+    } else if (millis() - lastFlush >= PUBLISH_WINDOW) {
+        publishFlush();
+    }
+}
@@ -0,0 +1,89 @@
+/* =============================================================================
+   Publish.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_PUBLISH_H
+#define __COMFOAIR_ARDUINO_PUBLISH_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Publish scheduler
+   --------------------------------------------------------------------------
+   Decoded fields are handed in as samples. Once every PUBLISH_WINDOW, all
+   fields that moved past their deadband (or are due for a heartbeat) are
+   flushed as one message, grouped per command:
+
+      command=D2 t_comfort=21.50,t1_intake=8.00; command=0C fan_intake_pct=35
+
+   With PUBLISH_AGGREGATE defined, each field is sent as mean/min/max over
+   the window instead of the last sample.
+
+   Every unit (see ZEHNDER_UNITS) publishes on its own topics. The units
+   are flushed one after the other, each once the MQTT queue has drained,
+   so a window of several units never overflows the queue (one unit's
+   flush, at most a few messages, always fits an empty queue).
+
+   Values restored from EEPROM after a restart (see persist.h) are not
+   samples: they are sent once, on the unit's stale topic in the same
+   layout (with PUBLISH_FIELDS not at all: the retained field topics still
+   hold them), and a field leaves the stale set when it is decoded again.
+
+   With PUBLISH_FIELDS defined, every field goes to a topic of its own
+   instead, as a retained message holding just the value:
+
+      MQTTPUBTOPIC_DATA/t1_intake          8.00
+
+   A consumer then only subscribes to the fields it needs and receives the
+   latest value right away. Fields that share a key (e.g. t_comfort in
+   0x12 and 0xD2) share the topic.
+
+   With PUBLISH_BINARY defined, the same message is sent in a compact binary
+   form instead. Values are not scaled or formatted on the board: they are
+   sent raw, exactly as they sit in the ComfoAir data block, and the
+   receiver applies the scaling from caFields[] (see native/src/telemetry.h
+   for a decoder).
+
+   Message:
+      'C' 'T'        Magic
+      version        PUBLISH_BINARY_VERSION
+      flags          PUBLISH_FLAG_*
+      groups...
+
+   Group:
+      command        Command byte
+      count          Number of fields that follow
+      fields...
+
+   Field:
+      offset         Offset of the field in the data block (CAField.offset)
+      value          CAField.width bytes, big endian, raw (unscaled); with
+                     PUBLISH_FLAG_AGGREGATE: mean, min and max, in that order
+   -------------------------------------------------------------------------- */
+
+#define PUBLISH_WINDOW 10000                    // Flush window (ms); 0 = flush every loop
+#define PUBLISH_HEARTBEAT 300                   // Republish unchanged fields after this many seconds
+//#define PUBLISH_AGGREGATE                     // Send mean/min/max per window
+//#define PUBLISH_FIELDS                        // One retained topic per field (or build with -D PUBLISH_FIELDS)
+//#define PUBLISH_BINARY                        // Send binary messages (or build with -D PUBLISH_BINARY)
+
+#if defined(PUBLISH_FIELDS) && defined(PUBLISH_BINARY)
+#error "PUBLISH_FIELDS and PUBLISH_BINARY are alternative layouts: pick one"
+#endif
+
+// Binary message format
+#define PUBLISH_BINARY_VERSION 1
+#define PUBLISH_BINARY_HEADERSIZE 4             // Magic, version, flags
+#define PUBLISH_FLAG_AGGREGATE 0x01             // Every field carries mean, min and max
+
+// Function declarations
+void publishSample(uint8_t unit, uint8_t index, long value);
+bool publishLatest(uint8_t unit, uint8_t index, long& value);
+void publishMaintain();
+void publishFlush();
+void publishRestore(uint8_t unit, uint8_t index, long value);
+uint8_t publishStale(uint8_t unit);
+uint8_t publishStaleUnit(uint8_t unit);
+
+#endif
@@ -0,0 +1,137 @@
+/* =============================================================================
+   Queue.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "queue.h"
+
+#define QUEUE_NOROOM 0xFFFF
+
+MessageQueue::MessageQueue(byte* buffer, uint16_t size, uint8_t policy)
+    : _buffer(buffer), _size(size), _policy(policy) {
+    memset(&_stats, 0, sizeof(_stats));
+    clear();
+}
+
+void MessageQueue::clear() {
+    _head = 0;
+    _tail = 0;
+    _used = 0;
+    _count = 0;
+}
+
+// Moves the tail back to the start of the buffer if the writer wrapped there
+void MessageQueue::skipWrap() {
+    if ((_size - _tail < QUEUE_HEADERSIZE) || (_buffer[_tail] == QUEUE_WRAP)) {
+        _used -= (_size - _tail);
+        _tail = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// RESERVE
+// ---------------------------------------------------------------------------
+// Finds a contiguous region of "length" bytes. If the region at the end of
+// the buffer is too small, the writer wraps to the start and the remainder
+// is marked as padding.
+//
+// OUTPUTS:
+//    uint16_t       Start of the region, or QUEUE_NOROOM
+// ---------------------------------------------------------------------------
+
+uint16_t MessageQueue::reserve(uint16_t length) {
+    if (_count == 0) {
+        clear();
+    }
+    if ((_count > 0) && (_head == _tail)) {
+        return QUEUE_NOROOM;
+    }
+    if (_head < _tail) {
+        return (length <= _tail - _head) ? _head : QUEUE_NOROOM;
+    }
+    // Free space is [head, size) followed by [0, tail)
+    if (length <= _size - _head) {
+        return _head;
+    }
+    if (length <= _tail) {
+        if (_head < _size) {
+            _buffer[_head] = QUEUE_WRAP;
+        }
+        _used += _size - _head;
+        _head = 0;
+        return 0;
+    }
+    return QUEUE_NOROOM;
+}
+
+// ---------------------------------------------------------------------------
+// PUSH
+// ---------------------------------------------------------------------------
+// Copies a message into the queue, applying the drop policy when full.
+//
+// OUTPUTS:
+//    bool           TRUE if the message was queued
+// ---------------------------------------------------------------------------
+
+bool MessageQueue::push(uint8_t topic, const byte* payload, uint16_t length) {
+    uint16_t total = QUEUE_HEADERSIZE + length;
+    if (total > _size) {
+        _stats.dropped++;
+        return false;
+    }
+
+    uint16_t pos;
+    while ((pos = reserve(total)) == QUEUE_NOROOM) {
+        if ((_policy == QUEUE_DROP_NEWEST) || (_count == 0)) {
+            _stats.dropped++;
+            return false;
+        }
+        pop();
+        _stats.dropped++;
+    }
+
+    _buffer[pos] = topic;
+    _buffer[pos + 1] = length & 0xFF;
+    _buffer[pos + 2] = length >> 8;
+    memcpy(_buffer + pos + QUEUE_HEADERSIZE, payload, length);
+    _head = pos + total;
+    _used += total;
+    _count++;
+    _stats.queued++;
+    if (_used > _stats.highWater) {
+        _stats.highWater = _used;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// PEEK
+// ---------------------------------------------------------------------------
+// Returns the oldest message without removing it. The payload pointer stays
+// valid until the message is popped.
+// ---------------------------------------------------------------------------
+
+bool MessageQueue::peek(uint8_t& topic, const byte*& payload, uint16_t& length) {
+    if (_count == 0) {
+        return false;
+    }
+    skipWrap();
+    topic = _buffer[_tail];
+    length = _buffer[_tail + 1] | ((uint16_t)_buffer[_tail + 2] << 8);
+    payload = _buffer + _tail + QUEUE_HEADERSIZE;
+    return true;
+}
+
+void MessageQueue::pop() {
+    if (_count == 0) {
+        return;
+    }
+    skipWrap();
+    uint16_t total = QUEUE_HEADERSIZE + (_buffer[_tail + 1] | ((uint16_t)_buffer[_tail + 2] << 8));
+    _tail += total;
+    _used -= total;
+    _count--;
+    if (_count == 0) {
+        clear();
+    }
+}
@@ -0,0 +1,63 @@
+/* =============================================================================
+   Queue.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_QUEUE_H
+#define __COMFOAIR_ARDUINO_QUEUE_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Fixed-capacity message queue
+   --------------------------------------------------------------------------
+   Variable-length messages are stored back to back in one byte array, each
+   preceded by a 3-byte header (topic id, length). A message never wraps
+   around the end of the array, so its payload can be handed to the network
+   layer in place. When the queue is full, the configured drop policy
+   decides whether the oldest queued messages or the new one is discarded.
+   -------------------------------------------------------------------------- */
+
+#define QUEUE_HEADERSIZE 3                      // Topic id + 16-bit length
+#define QUEUE_WRAP 0xFF                         // Topic id marking "continue at start"
+
+enum QueueDropPolicy : uint8_t {
+    QUEUE_DROP_OLDEST = 0,                      // Make room by discarding the oldest messages
+    QUEUE_DROP_NEWEST                           // Refuse the new message
+};
+
+struct QueueStats {
+    uint16_t queued;                            // Messages accepted
+    uint16_t dropped;                           // Messages discarded due to lack of space
+    uint16_t highWater;                         // Largest number of bytes in use
+};
+
+class MessageQueue {
+    public:
+        MessageQueue(byte* buffer, uint16_t size, uint8_t policy = QUEUE_DROP_OLDEST);
+
+        bool push(uint8_t topic, const byte* payload, uint16_t length);
+        bool peek(uint8_t& topic, const byte*& payload, uint16_t& length);
+        void pop();
+        void clear();
+
+        bool empty() const                      { return _count == 0; }
+        uint8_t count() const                   { return _count; }
+        uint16_t used() const                   { return _used; }
+        const QueueStats& stats() const         { return _stats; }
+
+    private:
+        byte* _buffer;
+        uint16_t _size;
+        uint8_t _policy;
+        uint16_t _head;                         // Where the next message is written
+        uint16_t _tail;                         // Oldest message
+        uint16_t _used;                         // Bytes in use (including wrap padding)
+        uint8_t _count;                         // Messages in the queue
+        QueueStats _stats;
+
+        void skipWrap();
+        uint16_t reserve(uint16_t length);
+};
+
+#endif
@@ -0,0 +1,181 @@
+/* =============================================================================
+   Scheduler.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "scheduler.h"
+#include "log.h"
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+static const SchedTask* schedTasks = NULL;      // Task table (PROGMEM)
+static uint8_t schedCount = 0;
+static void (*schedIngest)() = NULL;            // Reads the serial ports
+
+static unsigned long schedDue[SCHED_MAXTASKS];  // millis() at which each task is due
+static SchedStats schedCounters[SCHED_MAXTASKS];
+
+static unsigned long schedLastIngest = 0;       // micros() at the end of the last serial read
+static uint32_t schedGap = 0;                   // Longest time between two serial reads (us)
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+// ---------------------------------------------------------------------------
+// SCHEDINIT
+// ---------------------------------------------------------------------------
+// Sets the task table; every task is due right away.
+//
+// INPUTS:
+//    tasks          Task table in PROGMEM
+//    count          Number of rows, at most SCHED_MAXTASKS
+//    ingest         Reads the serial ports, called between all tasks
+// ---------------------------------------------------------------------------
+
+void schedInit(const SchedTask* tasks, uint8_t count, void (*ingest)()) {
+    if (count > SCHED_MAXTASKS) {
+        LOG_ERRORLN(F("Scheduler: too many tasks"));
+        count = SCHED_MAXTASKS;
+    }
+    schedTasks = tasks;
+    schedCount = count;
+    schedIngest = ingest;
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < count; i++) {
+        schedDue[i] = now;
+    }
+}
+
+// Reads the serial ports and keeps track of the longest time in between
+static void schedIngestNow() {
+    unsigned long now = micros();
+    if (schedLastIngest != 0 && now - schedLastIngest > schedGap) {
+        schedGap = now - schedLastIngest;
+    }
+    schedIngest();
+    schedLastIngest = micros();
+}
+
+// ---------------------------------------------------------------------------
+// SCHEDRUN
+// ---------------------------------------------------------------------------
+// One pass, called from loop(): reads the serial ports, then runs the due
+// tasks in order of priority and lateness, reading the ports again after
+// each one. Every task runs at most once per pass.
+// ---------------------------------------------------------------------------
+
+void schedRun() {
+    unsigned long start = micros();
+    uint16_t ran = 0;                           // Tasks already run in this pass
+    schedIngestNow();
+
+    for (;;) {
+        unsigned long now = millis();
+        bool deferring = (micros() - start >= SCHED_PASSBUDGET);
+        uint8_t next = SCHED_MAXTASKS;
+        uint8_t nextPriority = 0;
+        long nextLateness = 0;
+        for (uint8_t i = 0; i < schedCount; i++) {
+            long lateness = (long)(now - schedDue[i]);
+            if ((ran & ((uint16_t)1 << i)) || lateness < 0) {
+                continue;
+            }
+            uint8_t priority = pgm_read_byte(&schedTasks[i].priority);
+            if (deferring && priority != SCHED_CRITICAL) {
+                uint16_t period = pgm_read_word(&schedTasks[i].period);
+                if (lateness <= (long)(period ? period : SCHED_MAXDEFER)) {
+                    continue;                   // Can wait for the next pass
+                }
+            }
+            if (next == SCHED_MAXTASKS || priority < nextPriority ||
+                (priority == nextPriority && lateness > nextLateness)) {
+                next = i;
+                nextPriority = priority;
+                nextLateness = lateness;
+            }
+        }
+        if (next == SCHED_MAXTASKS) {
+            return;
+        }
+
+        SchedTask task;
+        memcpy_P(&task, &schedTasks[next], sizeof(task));
+        ran |= ((uint16_t)1 << next);
+        unsigned long begin = micros();
+        task.run();
+        uint32_t duration = micros() - begin;
+
+        SchedStats& stats = schedCounters[next];
+        stats.runs++;
+        if (duration > task.budget && stats.overruns < 0xFFFF) stats.overruns++;
+        if (duration > stats.maxDuration) stats.maxDuration = duration;
+        if (nextLateness > stats.maxLateness) stats.maxLateness = nextLateness > 0xFFFF ? 0xFFFF : nextLateness;
+
+        // Keep the task's rhythm, unless it fell more than a period behind
+        if (task.period != 0 && nextLateness < (long)task.period) {
+            schedDue[next] += task.period;
+        } else {
+            schedDue[next] = now + task.period;
+        }
+
+        schedIngestNow();
+    }
+}
+
+const SchedStats& schedStats(uint8_t task) {
+    return schedCounters[task];
+}
+
+uint32_t schedMaxGap() {
+    return schedGap;
+}
+
+// ---------------------------------------------------------------------------
+// SCHEDREPORT
+// ---------------------------------------------------------------------------
+// Appends " gap=..." (first message only) and " <task>=lateness/duration/
+// overruns" for as many tasks as fit in a status message, and starts a new
+// interval for the worst values of the tasks it reported.
+//
+// INPUTS:
+//    msg            Status message, its header already appended
+//    task           First task to report (0 on the first call); set to the
+//                   first task that did not fit
+//
+// OUTPUTS:
+//    bool           TRUE once every task is reported; FALSE if the rest
+//                   has to go into a further message
+// ---------------------------------------------------------------------------
+
+bool schedReport(PayloadWriter& msg, uint8_t& task) {
+    if (task == 0) {
+        msg.append(F(" gap="));
+        msg.appendInt(schedGap);
+        schedGap = 0;
+    }
+    uint16_t start = msg.length();
+    for (; task < schedCount; task++) {
+        SchedStats& stats = schedCounters[task];
+        uint16_t mark = msg.length();
+        msg.append(' ');
+        msg.append((const __FlashStringHelper*)pgm_read_ptr(&schedTasks[task].name));
+        msg.append('=');
+        msg.appendInt(stats.maxLateness);
+        msg.append('/');
+        msg.appendInt(stats.maxDuration);
+        msg.append('/');
+        msg.appendInt(stats.overruns);
+        if (msg.overflow()) {
+            msg.truncate(mark);
+            // A task that fits no message at all is left out, so the
+            // report still ends
+            if (mark > start) return false;
+        }
+        stats.maxLateness = 0;
+        stats.maxDuration = 0;
+    }
+    return true;
+}
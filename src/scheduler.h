@@ -0,0 +1,84 @@
+/* =============================================================================
+   Scheduler.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_SCHEDULER_H
+#define __COMFOAIR_ARDUINO_SCHEDULER_H
+
+#include <Arduino.h>
+#include "payload.h"
+
+/* --------------------------------------------------------------------------
+   Cooperative loop scheduler
+   --------------------------------------------------------------------------
+   loop() hands its work to schedRun(). The work is split into tasks
+   (loopTasks[] in main.cpp), each a short step that returns quickly:
+
+   period     ms between runs (0 = once every pass)
+   budget     us one run may take
+   priority   SchedPriority; of the tasks that are due, the highest class
+              runs first, and within a class the one that is most overdue
+
+   Reading the serial ports is not a task: it runs at the start of every
+   pass and again after every task. Bytes from the units therefore wait for
+   at most one task, never for a whole pass of network work.
+
+   A pass keeps starting due tasks until SCHED_PASSBUDGET us are spent; the
+   rest wait for the next pass. Past the pass budget, only SCHED_CRITICAL
+   tasks still start, along with tasks that are overdue by more than their
+   period (SCHED_MAXDEFER ms for tasks without one), so no task starves.
+
+   Tasks cannot be interrupted: a run that takes longer than its budget is
+   counted as an overrun. With STATS_ENABLE, the timing of every task goes
+   out on the system topic right after the status line:
+
+      command=04 gap=1210 control=1/52/0 poll=2/140/0 mqtt=3/48010/1
+
+   gap        Longest time between two serial reads (us)
+   <task>     Worst lateness in ms (from due to start; for tasks that run
+              every pass, the time between two runs), longest run in us,
+              and overruns since boot
+
+   Lateness, run time and gap are the worst of the last STATS_INTERVAL.
+   When the tasks do not all fit one message (MQTT_MAX_PAYLOAD_SIZE), the
+   rest follow in further command=04 messages, never splitting a task.
+   -------------------------------------------------------------------------- */
+
+#define SCHED_MAXTASKS 16                       // Rows in a task table, at most
+#define SCHED_PASSBUDGET 4000                   // us of tasks per pass before deferring the rest
+#define SCHED_MAXDEFER 50                       // Longest deferral of a task that runs every pass (ms)
+
+// Task classes, most urgent first
+enum SchedPriority : uint8_t {
+    SCHED_CRITICAL = 0,                         // Runs every time it is due, whatever the pass budget
+    SCHED_HIGH,
+    SCHED_NORMAL,
+    SCHED_LOW
+};
+
+// Task table entry
+struct SchedTask {
+    const char* name;                           // Report key (PROGMEM)
+    void (*run)();
+    uint16_t period;                            // ms between runs (0 = every pass)
+    uint16_t budget;                            // us a run may take
+    uint8_t priority;                           // SchedPriority
+};
+
+// Timing of one task
+struct SchedStats {
+    uint32_t runs;                              // Runs since boot
+    uint16_t overruns;                          // Runs over budget since boot
+    uint16_t maxLateness;                       // Worst lateness (ms)
+    uint32_t maxDuration;                       // Longest run (us)
+};
+
+// Function declarations
+void schedInit(const SchedTask* tasks, uint8_t count, void (*ingest)());
+void schedRun();
+const SchedStats& schedStats(uint8_t task);
+uint32_t schedMaxGap();
+bool schedReport(PayloadWriter& msg, uint8_t& task);
+
+#endif
@@ -0,0 +1,212 @@
+/* =============================================================================
+   Stats.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "stats.h"
+
+#ifdef STATS_ENABLE
+
+#include "decoder.h"
+#include "uart.h"
+#include "payload.h"
+#include "mqtt.h"
+#include "scheduler.h"
+#include "log.h"
+
+extern ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+SystemStats systemStats;
+
+static unsigned long statsLastLoop = 0;         // micros() at the end of the previous loop()
+static uint32_t statsLoopSum = 0;               // Sum of iteration times in this interval (us)
+static uint16_t statsLoopCount = 0;
+static uint32_t statsLoopMax = 0;
+
+static unsigned long statsLastTick = 0;         // millis() of the last uptime update
+static uint32_t statsUptime = 0;                // Seconds since boot (does not wrap like millis())
+static uint16_t statsUptimeMillis = 0;          // Remainder towards the next second
+static unsigned long statsLastPublish = 0;
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+#if defined(__AVR__)
+
+#define STATS_PAINT 0xC5                        // Pattern in RAM that was never used
+
+extern uint8_t _end;                            // End of .bss: start of the heap
+extern uint8_t __stack;                         // Top of RAM: start of the stack
+
+// Paints all RAM between the variables and the top of the stack before
+// main() runs (.init1: before the stack pointer and r1 are set up, hence
+// assembly), so the deepest the stack ever reached can be found later
+void statsPaintStack() __attribute__((naked, used, section(".init1")));
+void statsPaintStack() {
+    __asm volatile(
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (STATS_PAINT));
+}
+
+#endif
+
+// Free RAM between heap and stack that was never used since boot: the
+// painted bytes above the top of the heap
+static uint16_t statsFreeRam() {
+#if defined(__AVR__)
+    extern char* __brkval;
+    const uint8_t* p = __brkval ? (const uint8_t*)__brkval : &_end;
+    uint16_t count = 0;
+    while (p <= &__stack && *p == STATS_PAINT) {
+        p++;
+        count++;
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// STATSMAINTAIN
+// ---------------------------------------------------------------------------
+// Call at the end of every loop(): measures the iteration that just ended,
+// tracks uptime, and publishes once every
+// STATS_INTERVAL.
+// ---------------------------------------------------------------------------
+
+void statsMaintain() {
+    unsigned long now = micros();
+    if (statsLastLoop != 0) {
+        uint32_t elapsed = now - statsLastLoop;
+        statsLoopSum += elapsed;
+        if (elapsed > statsLoopMax) statsLoopMax = elapsed;
+        if (statsLoopCount < 0xFFFF) statsLoopCount++;
+    }
+    statsLastLoop = now;
+
+    unsigned long ms = millis();
+    unsigned long delta = ms - statsLastTick;
+    statsLastTick = ms;
+    delta += statsUptimeMillis;
+    statsUptime += delta / 1000;
+    statsUptimeMillis = delta % 1000;
+
+    if (ms - statsLastPublish >= STATS_INTERVAL) {
+        statsLastPublish = ms;
+        statsPublish();
+    }
+}
+
+// Formats " key=first", or " key=first/second" for a pair
+static void statsFormat(PayloadWriter& msg, const __FlashStringHelper* key, long first, long second, bool pair) {
+    msg.append(' ');
+    msg.append(key);
+    msg.append('=');
+    msg.appendInt(first);
+    if (pair) {
+        msg.append('/');
+        msg.appendInt(second);
+    }
+}
+
+// Appends a field to the status line. One that does not fit any more
+// starts a new "command=01" message, once the full one is queued.
+static void statsField(PayloadWriter& msg, const __FlashStringHelper* key, long first, long second, bool pair) {
+    uint16_t mark = msg.length();
+    statsFormat(msg, key, first, second, pair);
+    if (msg.overflow()) {
+        msg.truncate(mark);
+        mqttPublishSystem(msg.c_str(), msg.length());
+        msg.reset();
+        msg.append(F("command=01"));
+        statsFormat(msg, key, first, second, pair);
+    }
+}
+
+// Appends " key=value"
+static void statsAppend(PayloadWriter& msg, const __FlashStringHelper* key, long value) {
+    statsField(msg, key, value, 0, false);
+}
+
+// Appends " key=first/second"
+static void statsAppend(PayloadWriter& msg, const __FlashStringHelper* key, long first, long second) {
+    statsField(msg, key, first, second, true);
+}
+
+// ---------------------------------------------------------------------------
+// STATSPUBLISH
+// ---------------------------------------------------------------------------
+// Queues the status line on the system topic and starts a new loop timing
+// interval. With large counters and a long unit prefix the line may not
+// fit one message: it then continues in a second "command=01" message.
+// ---------------------------------------------------------------------------
+
+void statsPublish() {
+    PayloadWriter msg(mqttPayload, sizeof(mqttPayload));
+
+    // Receive and decoder counters of all units together
+    CADecoderStats decoder;
+    UartStats uart;
+    memset(&decoder, 0, sizeof(decoder));
+    memset(&uart, 0, sizeof(uart));
+    for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+        const CADecoderStats& d = zehnderDecoders[unit].stats();
+        UartStats u = zehnderUarts[unit]->stats();
+        decoder.frames += d.frames;
+        decoder.checksumErrors += d.checksumErrors;
+        decoder.framingErrors += d.framingErrors;
+        decoder.noiseBytes += d.noiseBytes;
+        uart.bytes += u.bytes;
+        uart.overflows += u.overflows;
+        uart.overruns += u.overruns;
+    }
+
+    msg.append(F("command=01"));
+    statsAppend(msg, F("up"), statsUptime);
+    statsAppend(msg, F("loop"), statsLoopCount ? statsLoopSum / statsLoopCount : 0, statsLoopMax);
+    statsAppend(msg, F("ram"), statsFreeRam());
+    statsAppend(msg, F("rx"), uart.bytes);
+    statsAppend(msg, F("frames"), decoder.frames);
+    statsAppend(msg, F("crc"), decoder.checksumErrors);
+    statsAppend(msg, F("framing"), decoder.framingErrors);
+    statsAppend(msg, F("noise"), decoder.noiseBytes);
+    statsAppend(msg, F("ovf"), (long)uart.overflows + uart.overruns);
+    statsAppend(msg, F("pub"), systemStats.published, systemStats.publishFailed);
+    statsAppend(msg, F("drop"), mqttQueueStats().dropped);
+    statsAppend(msg, F("reconnect"), systemStats.reconnects, systemStats.reconnectMillis);
+#ifdef LOG_NONBLOCKING
+    statsAppend(msg, F("logdrop"), logBuffer.dropped());
+#endif
+    mqttPublishSystem(msg.c_str(), msg.length());
+
+    // Timing of the loop tasks, in as many messages as it takes
+    uint8_t task = 0;
+    bool done;
+    do {
+        msg.reset();
+        msg.append(F("command=04"));
+        done = schedReport(msg, task);
+        mqttPublishSystem(msg.c_str(), msg.length());
+    } while (!done);
+
+    statsLoopSum = 0;
+    statsLoopCount = 0;
+    statsLoopMax = 0;
+}
+
+#endif
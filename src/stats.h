@@ -0,0 +1,77 @@
+/* =============================================================================
+   Stats.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_STATS_H
+#define __COMFOAIR_ARDUINO_STATS_H
+
+#include <Arduino.h>
+
+/* --------------------------------------------------------------------------
+   Runtime statistics
+   --------------------------------------------------------------------------
+   Every STATS_INTERVAL, a compact status line is published on
+   MQTTPUBTOPIC_SYSTEM:
+
+      command=01 up=3600 loop=310/48210 ram=2870 rx=345600 frames=7200
+      crc=0 framing=1 noise=12 ovf=0 pub=360/0 drop=0 reconnect=1/2013
+      logdrop=0
+
+   up          Uptime in seconds
+   loop        Average/maximum loop() iteration time in us (this interval)
+   ram         Free RAM between heap and stack that the stack never
+               reached since boot, however deep a handler went (the RAM is
+               painted with a pattern at start-up; bytes; 0 on the host
+               build)
+   rx          Bytes received from the unit
+   frames      Valid frames decoded
+   crc         Frames dropped on a checksum mismatch
+   framing     Frames dropped and resynchronised on a misplaced 07 sequence
+   noise       Bytes skipped between frames
+   ovf         Bytes lost because the receive ring was full or overrun
+               (rx to ovf: all units together)
+   pub         MQTT publishes that succeeded/failed
+   drop        Messages dropped from the outbound queue
+   reconnect   MQTT reconnect attempts/ms spent blocked in them
+   logdrop     Debug output bytes dropped because the log buffer was full
+               (only with LOG_NONBLOCKING, see log.h)
+
+   A line too long for one message (MQTT_MAX_PAYLOAD_SIZE) goes on in a
+   further command=01 message; no field is split. The timing of every
+   loop task follows as a second line (command=04, see scheduler.h).
+
+   Counters run from boot. Without STATS_ENABLE, all of this (including
+   the STATS_* counting macros spread over the code) compiles to nothing.
+   -------------------------------------------------------------------------- */
+
+#define STATS_ENABLE                            // Comment out to remove all instrumentation
+#define STATS_INTERVAL 60000                    // Publish every this many ms
+
+#ifdef STATS_ENABLE
+
+// Counters kept by other modules through the macros below
+struct SystemStats {
+    uint32_t published;                         // Successful MQTT publishes
+    uint16_t publishFailed;                     // Failed MQTT publishes
+    uint16_t reconnects;                        // MQTT reconnect attempts
+    uint32_t reconnectMillis;                   // Time spent blocked in mqttReconnect()
+};
+
+extern SystemStats systemStats;
+
+#define STATS_INC(counter) (systemStats.counter++)
+#define STATS_ADD(counter, value) (systemStats.counter += (value))
+
+// Function declarations
+void statsMaintain();
+void statsPublish();
+
+#else
+
+#define STATS_INC(counter)
+#define STATS_ADD(counter, value)
+
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+/* =============================================================================
+   Uart.cpp
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#include "uart.h"
+
+/*=============================================================================
+   GLOBAL VARIABLES
+  ============================================================================= */
+
+ZehnderUartPort<1> zehnderUart1;
+#if ZEHNDER_UNITS > 1
+ZehnderUartPort<2> zehnderUart2;
+#endif
+#if ZEHNDER_UNITS > 2
+ZehnderUartPort<3> zehnderUart3;
+#endif
+
+ZehnderUart* const zehnderUarts[ZEHNDER_UNITS] = {
+    &zehnderUart1,
+#if ZEHNDER_UNITS > 1
+    &zehnderUart2,
+#endif
+#if ZEHNDER_UNITS > 2
+    &zehnderUart3,
+#endif
+};
+
+/*=============================================================================
+   FUNCTIONS
+  ============================================================================= */
+
+ZehnderUart::ZehnderUart() : _lastReceive(0) {
+    _stats.bytes = 0;
+    _stats.overflows = 0;
+    _stats.overruns = 0;
+    _stats.sent = 0;
+}
+
+// Releases bytes read through span(); also marks the line as active, so
+// the poller can tell how long it has been quiet.
+void ZehnderUart::consume(uint16_t count) {
+    _rx.consume(count);
+    if (count > 0) {
+        _lastReceive = millis();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// ZEHNDERUART::WRITE
+// ---------------------------------------------------------------------------
+// Queues bytes for transmission. A frame is either queued completely or not
+// at all, so it can never be cut in half on the line.
+//
+// OUTPUTS:
+//    bool           TRUE if queued, FALSE if the transmit ring is too full
+// ---------------------------------------------------------------------------
+
+bool ZehnderUart::write(const byte* data, uint16_t length) {
+    if (ZEHNDER_TXBUFFER - _tx.available() < length) {
+        return false;
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        UART_ATOMIC { _tx.put(data[i]); }
+    }
+    startTransmit();
+    return true;
+}
+
+// Consistent copy of the counters (they are updated from the ISR)
+UartStats ZehnderUart::stats() const {
+    UartStats copy;
+    UART_ATOMIC {
+        copy.bytes = _stats.bytes;
+        copy.overflows = _stats.overflows;
+        copy.overruns = _stats.overruns;
+        copy.sent = _stats.sent;
+    }
+    return copy;
+}
+
+// Starts the port of every unit
+void uartBegin(unsigned long baud) {
+    zehnderUart1.begin(baud);
+#if ZEHNDER_UNITS > 1
+    zehnderUart2.begin(baud);
+#endif
+#if ZEHNDER_UNITS > 2
+    zehnderUart3.begin(baud);
+#endif
+}
+
+#if defined(__AVR__)
+
+// Register block of each USART: UCSRnA, UCSRnB, UCSRnC, -, UBRRnL, UBRRnH, UDRn
+template <uint8_t USART> struct UsartRegisters;
+template <> struct UsartRegisters<1> { enum { base = 0xC8 }; };    // UCSR1A
+template <> struct UsartRegisters<2> { enum { base = 0xD0 }; };    // UCSR2A
+template <> struct UsartRegisters<3> { enum { base = 0x130 }; };   // UCSR3A
+
+#define USART_UCSRA(n)  _SFR_MEM8(UsartRegisters<n>::base + 0)
+#define USART_UCSRB(n)  _SFR_MEM8(UsartRegisters<n>::base + 1)
+#define USART_UCSRC(n)  _SFR_MEM8(UsartRegisters<n>::base + 2)
+#define USART_UBRR(n)   _SFR_MEM16(UsartRegisters<n>::base + 4)
+#define USART_UDR(n)    _SFR_MEM8(UsartRegisters<n>::base + 6)
+
+// ---------------------------------------------------------------------------
+// ZEHNDERUARTPORT::BEGIN
+// ---------------------------------------------------------------------------
+// Configures the USART for 8N1 at the given baud rate (double speed mode,
+// same divisor calculation as the Arduino core), enables the receiver and
+// transmitter and the receive interrupt.
+// ---------------------------------------------------------------------------
+
+template <uint8_t USART>
+void ZehnderUartPort<USART>::begin(unsigned long baud) {
+    uint16_t divisor = (F_CPU / 4 / baud - 1) / 2;
+    _ucsrb = &USART_UCSRB(USART);
+    USART_UCSRA(USART) = _BV(U2X0);
+    USART_UBRR(USART) = divisor;
+    USART_UCSRC(USART) = _BV(UCSZ01) | _BV(UCSZ00);         // 8N1
+    USART_UCSRB(USART) = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+}
+
+// The data register empty interrupt fires as long as it is enabled and the
+// transmitter can take a byte
+void ZehnderUart::startTransmit() {
+    *_ucsrb |= _BV(UDRIE0);
+}
+
+template <uint8_t USART>
+inline void ZehnderUartPort<USART>::rxInterrupt() {
+    bool overrun = USART_UCSRA(USART) & _BV(DOR0);
+    byte c = USART_UDR(USART);
+    receive(c, overrun);
+}
+
+template <uint8_t USART>
+inline void ZehnderUartPort<USART>::udreInterrupt() {
+    byte c;
+    if (transmit(c)) {
+        USART_UDR(USART) = c;
+    } else {
+        USART_UCSRB(USART) &= ~_BV(UDRIE0);                 // Ring empty: stop until the next write()
+    }
+}
+
+ISR(USART1_RX_vect)   { zehnderUart1.rxInterrupt(); }
+ISR(USART1_UDRE_vect) { zehnderUart1.udreInterrupt(); }
+#if ZEHNDER_UNITS > 1
+ISR(USART2_RX_vect)   { zehnderUart2.rxInterrupt(); }
+ISR(USART2_UDRE_vect) { zehnderUart2.udreInterrupt(); }
+#endif
+#if ZEHNDER_UNITS > 2
+ISR(USART3_RX_vect)   { zehnderUart3.rxInterrupt(); }
+ISR(USART3_UDRE_vect) { zehnderUart3.udreInterrupt(); }
+#endif
+
+#else
+
+// Host build: the simulated serial port calls this for every byte it
+// receives, just like the interrupt would.
+template <uint8_t USART>
+static void zehnderRxInterrupt(uint8_t c) {
+    zehnderUarts[USART - 1]->receive(c, false);
+}
+
+template <uint8_t USART>
+void ZehnderUartPort<USART>::begin(unsigned long baud) {
+    HardwareSerial* const ports[] = { &Serial1, &Serial2, &Serial3 };
+    _port = ports[USART - 1];
+    _port->begin(baud, ZEHNDER_SERIALSETTINGS);
+    _port->attachRxInterrupt(zehnderRxInterrupt<USART>);
+}
+
+// Host build: the simulated port takes everything at once
+void ZehnderUart::startTransmit() {
+    byte c;
+    while (transmit(c)) {
+        _port->write(c);
+    }
+}
+
+#endif
@@ -0,0 +1,176 @@
+/* =============================================================================
+   Uart.h
+   Written in 2018 by Tim Jacobs
+  ============================================================================= */
+
+#ifndef __COMFOAIR_ARDUINO_UART_H
+#define __COMFOAIR_ARDUINO_UART_H
+
+#include <Arduino.h>
+#include "zehnder.h"
+
+/* --------------------------------------------------------------------------
+   Interrupt-driven Zehnder port capture
+   --------------------------------------------------------------------------
+   Our own USART receive interrupt stores every byte in a single-producer/
+   single-consumer ring buffer, independent of how long loop() is busy with
+   the network. The main loop reads the ring in place through span() and
+   consume(), so bytes are never copied a second time.
+
+   Outgoing frames take the opposite route: write() copies them into a
+   second ring which the data register empty interrupt sends out byte by
+   byte.
+
+   Every unit has its own ZehnderUart: unit 0 uses USART1, unit 1 USART2
+   and unit 2 USART3. The USART number is a template parameter of
+   ZehnderUartPort, so its interrupt handlers address the registers and
+   the ring buffers of that one port directly, without any lookup.
+
+   NOTE: since we own the USARTs' RX interrupts, the Arduino core's
+   Serial1..Serial3 objects must not be referenced anywhere in the
+   firmware, or the linker will find two handlers for the same vector.
+   -------------------------------------------------------------------------- */
+
+#define ZEHNDER_RXBUFFER 256                    // Ring buffer size; power of two
+#define ZEHNDER_TXBUFFER 64                     // Transmit ring size; power of two
+
+#if defined(__AVR__)
+#include <util/atomic.h>
+#define UART_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define UART_ATOMIC
+#endif
+
+struct UartStats {
+    uint32_t bytes;                             // Bytes received
+    uint16_t overflows;                         // Bytes lost because the ring buffer was full
+    uint16_t overruns;                          // Bytes lost in hardware (USART data overrun)
+    uint32_t sent;                              // Bytes transmitted
+};
+
+// ---------------------------------------------------------------------------
+// Lock-free SPSC ring buffer: the producer only writes _head, the consumer
+// only writes _tail. Indices run freely and are masked on access. Whichever
+// side runs in the main loop must do so atomically (the indices are 16 bit).
+// ---------------------------------------------------------------------------
+
+template <uint16_t SIZE>
+class SpscRing {
+    static_assert((SIZE & (SIZE - 1)) == 0, "Ring buffer size must be a power of two");
+
+    public:
+        SpscRing() : _head(0), _tail(0) {}
+
+        // Producer side
+        inline bool put(byte c) {
+            uint16_t head = _head;
+            if ((uint16_t)(head - _tail) >= SIZE) {
+                return false;
+            }
+            _buffer[head & (SIZE - 1)] = c;
+            _head = head + 1;
+            return true;
+        }
+
+        // Consumer side
+        inline bool get(byte& c) {
+            uint16_t tail = _tail;
+            if (tail == _head) {
+                return false;
+            }
+            c = _buffer[tail & (SIZE - 1)];
+            _tail = tail + 1;
+            return true;
+        }
+
+        uint16_t available() const {
+            uint16_t head, tail;
+            UART_ATOMIC { head = _head; tail = _tail; }
+            return head - tail;
+        }
+
+        uint16_t span(const byte*& data) const {
+            uint16_t count = available();
+            uint16_t offset = _tail & (SIZE - 1);
+            if (count > SIZE - offset) {
+                count = SIZE - offset;              // Up to the end of the buffer
+            }
+            data = (const byte*)_buffer + offset;
+            return count;
+        }
+
+        void consume(uint16_t count) {
+            UART_ATOMIC { _tail += count; }
+        }
+
+    private:
+        volatile uint16_t _head;
+        volatile uint16_t _tail;
+        volatile byte _buffer[SIZE];
+};
+
+class ZehnderUart {
+    public:
+        ZehnderUart();
+
+        // Called from the receive interrupt
+        inline void receive(byte c, bool overrun) {
+            _stats.bytes++;
+            if (overrun) _stats.overruns++;
+            if (!_rx.put(c)) _stats.overflows++;
+        }
+
+        // Called from the data register empty interrupt
+        inline bool transmit(byte& c) {
+            if (!_tx.get(c)) return false;
+            _stats.sent++;
+            return true;
+        }
+
+        uint16_t available() const              { return _rx.available(); }
+        uint16_t span(const byte*& data) const  { return _rx.span(data); }
+        void consume(uint16_t count);
+        unsigned long lastReceive() const       { return _lastReceive; }
+
+        bool write(const byte* data, uint16_t length);
+        bool sending() const                    { return _tx.available() > 0; }
+
+        UartStats stats() const;
+
+    protected:
+        SpscRing<ZEHNDER_RXBUFFER> _rx;
+        SpscRing<ZEHNDER_TXBUFFER> _tx;
+        unsigned long _lastReceive;             // millis() when received bytes were last consumed
+        volatile UartStats _stats;
+#if defined(__AVR__)
+        volatile uint8_t* _ucsrb;               // UCSRnB, to start the transmitter from write()
+#else
+        HardwareSerial* _port;                  // Simulated port
+#endif
+
+        void startTransmit();
+};
+
+// ---------------------------------------------------------------------------
+// ZehnderUart on a given USART (1..3). Only begin() and the interrupt
+// handlers depend on the port; everything the main loop uses is in the
+// base class, so it exists once in flash however many units there are.
+// ---------------------------------------------------------------------------
+
+template <uint8_t USART>
+class ZehnderUartPort : public ZehnderUart {
+    public:
+        void begin(unsigned long baud);
+#if defined(__AVR__)
+        inline void rxInterrupt();
+        inline void udreInterrupt();
+#endif
+};
+
+// The receive/transmit state of every unit
+extern ZehnderUart* const zehnderUarts[ZEHNDER_UNITS];
+
+// Function declarations
+void uartBegin(unsigned long baud);
+
+#endif
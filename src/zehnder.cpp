@@ -4,320 +4,136 @@
   ============================================================================= */
 
 #include "zehnder.h"
-#include "mqtt.h"
+#include "decoder.h"
+#include "uart.h"
+#include "payload.h"
+#include "commands.h"
+#include "publish.h"
+#include "poller.h"
+#include "control.h"
+#include "bus.h"
+#include "log.h"
+#include "capture.h"
 
-// Zehnder serial definitions
-HardwareSerial& zehnderPort = ZEHNDER_PORT;
-
-// Serial buffers
-byte serialBuffer[64];                              // To hold serial data 
-#define PROCESSBUFFERSIZE 2*CACMD_MAXLENGTH
-byte processBuffer[PROCESSBUFFERSIZE];              // Our backlog for processing data
-int processSize = 0;                                // How much data we have in the backlog
-#define CMDBUFFERSIZE CACMD_MAXLENGTH
-byte cmdBuffer[CMDBUFFERSIZE];                      // Our command buffer for parsing
-int cmdSize = 0;                                    // How much data we have in the cmdBuffer
+// Frame decoder of every unit
+ComfoAirDecoder zehnderDecoders[ZEHNDER_UNITS];
 
 // ---------------------------------------------------------------------------
 // ZEHNDERINIT
 // ---------------------------------------------------------------------------
-// Prepares serial port for reading
+// Prepares serial ports for reading (interrupt-driven capture) and, when
+// polling, for sending requests
 // ---------------------------------------------------------------------------
 
 void zehnderInit() {
-    DEBUGOUT.println(F("Init Zehnder Serial port..."));
-    zehnderPort.begin(ZEHNDER_BAUDRATE, SERIAL_8N1 );
-}
-
-// ---------------------------------------------------------------------------
-// CHECKCOMMAND
-// ---------------------------------------------------------------------------
-// Read new data on Zehnder Port, if any, and verify if we can find a 
-// complete command in our current memory buffers
-// ---------------------------------------------------------------------------
-
-void checkCommand() {
-    int bytesToRead = zehnderPort.available();
-    if (bytesToRead > 0) {
-        // Read data from the serial port
-        zehnderPort.readBytes(serialBuffer, bytesToRead);
-#ifdef TRACE
-        // Output to serial port what we read
-        DEBUGOUT.print("### UART: ");
-        dumpByteArray(serialBuffer, bytesToRead);
-#endif
-        int parseoffset = -1;
-        int previousparse = 0;
-        // Keep looping through old data + new data, as long as we keep on finding commands 
-        while (parseoffset != 0) {
-            previousparse = parseoffset;
-            // Check if we have a complete Zehnder command
-            parseoffset = checkBuffers(serialBuffer, bytesToRead, previousparse);
-            //DEBUGOUT.print("### PARSEOFFSET: "); DEBUGOUT.println(parseoffset);
-
-            // Command found?
-            if (cmdSize > 0) {
-                DEBUGOUT.print("### CMDSIZE: ");
-                DEBUGOUT.print(cmdSize);
-                DEBUGOUT.print(" / CMDBUFFER: ");
-                dumpByteArray(cmdBuffer, cmdSize);
-                processCommand();
-            }          
-        }
-        if (previousparse < 0) { previousparse = 0; };
-        
-        // Retain all data past the "previousparse" = point to which we processed already
-        if (previousparse < bytesToRead) {
-            int lengthToStore = (bytesToRead - previousparse);
-            // Does it fit in our processBuffer?
-            if (processSize + lengthToStore > PROCESSBUFFERSIZE){
-                // Not enough room! Just forget whatever we have now...
-                processSize = 0;
-            }
-            memcpy(processBuffer+processSize, serialBuffer+previousparse, lengthToStore);
-            
-            processSize += lengthToStore;
-    //      DEBUGOUT.print("### KEEPING: ");
-    //      DEBUGOUT.print(lengthToStore);
-    //      DEBUGOUT.print(" ### STORESIZE: ");
-    //      DEBUGOUT.print(processSize);
-    //      DEBUGOUT.print(" / STORE: ");
-    //      dumpByteArray(processBuffer, processSize);    
-        }
-    }
+    LOG_INFOLN(F("Init Zehnder Serial port..."));
+    uartBegin(ZEHNDER_BAUDRATE);
 }
 
 // ---------------------------------------------------------------------------
-// PROCESSCOMMAND
+// CHECKSPAN
 // ---------------------------------------------------------------------------
-// This function takes the command in the current cmdBuffer and acts
-// accordingly.
+// Feeds one contiguous span of captured bytes of a unit byte by byte into
+// its streaming frame decoder. Completed frames are processed immediately.
 //
-// INPUTS:
-//    none
 // OUTPUTS:
-//    bool           TRUE if command was succesfully parsed, FALSE otherwise
+//    uint16_t       Number of bytes processed (0 = nothing waiting)
 // ---------------------------------------------------------------------------
 
-bool processCommand() {
-//    uint8_t cmdByte1 = cmdBuffer[2];
-    uint8_t cmdByte2 = cmdBuffer[3];
-    String cmdString = byteToHexString(cmdByte2);
-    String cmdData = "";
-    
-    DEBUGOUT.print(F("CMD = 0x")); DEBUGOUT.print(cmdString);
-
-    bool parsed = false;
-    
-    switch(cmdByte2) {
-        case 0xD2:
-            // ReadTemperatures Extended command
-            //  - Provides details of the temperature sensors in the unit
-            //  - Example raw string: 
-            //    07F0 00D2 09504C4D54540F282828A0070F07F3 07F0
-            //  - Relevant data interpretation:
-            //       Byte[1] - Komfort Temperatur (°C*)
-            //       Byte[2] - T1 / Außenluft (°C*)
-            //       Byte[3] - T2 / Zuluft (°C*)
-            //       Byte[4] - T3 / Abluft (°C*)
-            //       Byte[5] - T4 / Fortluft (°C*)
-            cmdData = "t_comfort=" + String(getTemperature(cmdBuffer[5])) + ",t1_intake=" + String(getTemperature(cmdBuffer[6])) + ",t2_tohome=" + String(getTemperature(cmdBuffer[7])) + ",t3_fromhome=" + String(getTemperature(cmdBuffer[8])) + ",t4_exhaust=" + String(getTemperature(cmdBuffer[9]));
-            DEBUGOUT.print(" - "); DEBUGOUT.println(cmdData);
-            parsed = true;
-            break;
-        default :
-            DEBUGOUT.println(F(" - Not parsed"));
+static uint16_t checkSpan(uint8_t unit) {
+    ZehnderUart& uart = *zehnderUarts[unit];
+    ComfoAirDecoder& decoder = zehnderDecoders[unit];
+    const byte* data;
+    uint16_t count = uart.span(data);
+    if (count == 0) {
+        return 0;
     }
-
-    if (parsed) {
-        String dataOut = String("command=" + cmdString + " " + cmdData);
-        mqttPublishData(dataOut);   
+#ifdef CAPTURE_ENABLE
+    if (unit == 0) {
+        captureBytes(data, count);
     }
-    return true;
-}
-
-// ---------------------------------------------------------------------------
-// GETTEMPERATURE
-// ---------------------------------------------------------------------------
-// Zehnder returns (TEMP + 20) * 2 as a byte encoding for the temperature. For
-// output reasons we'll want to convert that back... 
-
-float getTemperature(byte zehnderTemp) {
-    return (((float)zehnderTemp / 2) - 20);
+#endif
+    for (uint16_t i = 0; i < count; i++) {
+        // Output to serial port what we read
+        LOG_TRACE(F("### UART: "));
+        LOG_TRACEHEX(data + i, 1);
+        LOG_TRACELN();
+        // Feed the decoder; act as soon as a frame or ACK completes
+        uint8_t event = decoder.push(data[i]);
+        if (event == CADEC_FRAME) {
+            LOG_DEBUG(F("### CMDSIZE: "));
+            LOG_DEBUG(decoder.size());
+            LOG_DEBUG(F(" / CMDBUFFER: "));
+            LOG_DEBUGHEX(decoder.buffer(), decoder.size());
+            LOG_DEBUGLN();
+            processCommand(unit, decoder);
+#ifdef BUS_ENABLE
+            busFrame(unit, decoder.commandByte(), decoder.dataLength());
+#endif
+            pollFrame(unit, decoder.commandByte());
+        } else if (event == CADEC_ACK) {
+#ifdef BUS_ENABLE
+            busAck(unit);
+#endif
+            controlAck(unit);
+        }
+    }
+    uart.consume(count);
+    return count;
 }
 
 // ---------------------------------------------------------------------------
-// CHECKBUFFERS
+// CHECKCOMMAND
 // ---------------------------------------------------------------------------
-// Method to check if we have a full Zehnder command in our current memory
-// buffers, that is in the "newdata" and our existing processBuffer. This
-// method will check if we find a complete Zehnder command either in the
-// existing processBuffer, or if we join the processBuffer with the newdata.
-// If a command is found, it is copied into the cmdBuffer.
-//
-// INPUTS:
-//    newdata       Array of new data to look for a complete command in
-//    newdatasize   Size of the newdata array
-//    offset        Starting position in new data to search
-// OUTPUTS:
-//    result        -1    A command was found completely in the processBuffer
-//                  int   The offset in newdata where a command finishes.
+// Read new data captured from the Zehnder ports, if any. The units take
+// turns, one span of their receive ring at a time, so a busy port cannot
+// hold up the others for more than one span.
 // ---------------------------------------------------------------------------
 
-int checkBuffers(byte* newdata, int newdatasize, int offset) {
-    int cmdstop = -1;
-    cmdSize = 0;                // Reset Zehnder command in memory 
-
-    // CASE1: CMDSTART in OLDDATA, CMDSTOP in OLDDATA
-    // Find command start code
-    int cmdstart = findSequence(processBuffer, processSize, 0, cacmd_StartCMD, 2);
-    if (cmdstart >= 0) {
-        // Start of command found in the old data buffer: stop of command also in old data buffer?
-        cmdstop = findSequence(processBuffer, processSize, 2, cacmd_StopCMD, 2);
-        if (cmdstop >= 0) {
-            // Start of command found and stop of command found in old data
-            int lengthToStore = cmdstop+2-cmdstart;
-            memcpy(cmdBuffer, processBuffer+cmdstart, lengthToStore);
-            cmdSize = lengthToStore;
-            
-            // Clean up: retain unparsed data in the processBuffer
-            int remainderSize = processSize - cmdstop - 2;
-            if (remainderSize > 0) {
-                memmove(processBuffer, processBuffer+cmdstop+2,remainderSize);
-            }
-            processSize = remainderSize;
-            return -1;       // We parsed nothing in the new data... 
-        }
-
-        // CASE2: CMDSTART in OLDDATA, CMDSTOP partially in OLDDATA & partially in NEWDATA
-        if (processSize > 0) {
-            if ((processBuffer[processSize-1] == cacmd_StopCMD[0]) & (newdata[0] == cacmd_StopCMD[1])) {
-                // Copy first part of command (all except last stop byte)
-                int lengthToStore = processSize-cmdstart;
-                memcpy(cmdBuffer, processBuffer+cmdstart, lengthToStore);
-                cmdBuffer[lengthToStore] = cacmd_StopCMD[1];      // manually add last byte
-                cmdSize = lengthToStore+1;
-                // Clean up: we got the entire old dataset, so drop it
-                processSize = 0;
-                return 1;                                         // we parsed only the first byte from the new data
-            }
-        }        
-        
-        // CASE3: CMDSTART in OLDDATA, CMDSTOP in NEWDATA
-        // Command stop in new data??
-        cmdstop = findSequence(newdata, newdatasize, 0, cacmd_StopCMD, 2);
-        if (cmdstop >= 0) {
-            // Start of command found in old data and stop of command found in new data
-            int lengthToStore = processSize-cmdstart;
-            memcpy(cmdBuffer, processBuffer+cmdstart, lengthToStore);
-            cmdSize = lengthToStore;               
-            memcpy(cmdBuffer+cmdSize, newdata, cmdstop+2);
-            cmdSize += cmdstop+2;
-
-            // Clean up: drop processBuffer, return parsing position
-            processSize = 0;
-            return cmdstop+2;
-        }
-
-    } else if (processSize > 0) {
-        // CASE4: CMDSTART partially in OLDDATA, CMDSTART partially in NEWDATA, CMDSTOP in NEWDATA
-        if ((processBuffer[processSize-1] == cacmd_StartCMD[0]) & (newdata[0] == cacmd_StartCMD[1])) {
-            cmdstop = findSequence(newdata, newdatasize, 0, cacmd_StopCMD, 2);
-            if (cmdstop >= 0) {
-                cmdBuffer[0] = cacmd_StartCMD[0];                   // manually set first byte
-                int lengthToStore = cmdstop+2;
-                memcpy(cmdBuffer+1, newdata, cmdstop+2);
-                cmdSize = cmdstop+3;
-                 
-                // Clean up: drop processBuffer, return parsing position
-                processSize = 0;
-                return cmdstop+2;               
-            }          
-        }
-    } 
-    // CASE5: CMDSTART in NEWDATA, CMDSTOP in NEWDATA (using OFFSET)
-    // Find command start code
-    cmdstart = findSequence(newdata, newdatasize, offset, cacmd_StartCMD, 2);
-    if (cmdstart >= 0) {
-        // Start of command found in the new data: stop of command also in new data buffer?
-        cmdstop = findSequence(newdata, newdatasize, 2+cmdstart, cacmd_StopCMD, 2);
-        if (cmdstop >= 0) {
-            // Start of command found and stop of command found in old data
-            int lengthToStore = cmdstop+2-cmdstart;
-            memcpy(cmdBuffer, newdata+cmdstart, lengthToStore);
-            cmdSize = lengthToStore;
-            // Return parsing position
-            return cmdstop+2;
+void checkCommand() {
+    bool busy;
+    do {
+        busy = false;
+        for (uint8_t unit = 0; unit < ZEHNDER_UNITS; unit++) {
+            if (checkSpan(unit) > 0) busy = true;
         }
-    }
-    // No command found in any buffer
-    cmdSize = 0;
-    return 0; 
+    } while (busy);
 }
 
 // ---------------------------------------------------------------------------
-// FINDSEQUENCE
+// PROCESSCOMMAND
 // ---------------------------------------------------------------------------
-// Linear search for a particular byte sequence inside a byte array.
-// TODO: can this be optimized using memchr?
+// This function takes a decoded command frame and acts accordingly.
 //
 // INPUTS:
-//    dataarray         The array to search within
-//    datalength        The length of the dataarray
-//    pos               The starting position for the search
-//    sequence          The byte sequence to search for within dataarray
-//    sequencelength    The length of the sequence to search for
+//    unit           Unit the frame came from
+//    frame          The decoder holding the frame that just completed
 // OUTPUTS:
-//    int               The starting position where the sequence was found
+//    bool           TRUE if command was succesfully parsed, FALSE otherwise
 // ---------------------------------------------------------------------------
 
-int findSequence(byte* dataarray, int datalength, int pos, const byte* sequence, int sequencelength) {
-    if (pos<0) { pos = 0; }                            // Sanity check
-    if ((datalength>=sequencelength) && (sequencelength>0)) {
-        int endpoint = datalength - sequencelength +1;     // past here no match is possible
-        byte firstByte = sequence[0];
-        while (pos < endpoint) {
-           if (dataarray[pos] == firstByte) {
-               // scan for rest of sequence
-               for (int offset2 = 1; offset2 < sequencelength; ++offset2) {
-                   if (dataarray[pos + offset2] != sequence[offset2]) {
-                       break; // mismatch? continue scanning with next byte
-                   }
-                   else if (offset2 == sequencelength - 1) {
-                       return pos; // all bytes matched!
-                   } // if
-               } // for
-           } // if
-           ++pos;
-       } // while
-    } // if
- 
-    // end of array reached without match
-    return -1;
-}
+bool processCommand(uint8_t unit, const ComfoAirDecoder& frame) {
+    uint8_t cmdByte2 = frame.commandByte();
+    const byte* data = frame.data();
 
-/* ===========================================================================
-   ===========================================================================
-   ===========================================================================
-   DATA CONVERSION CODE
-   ===========================================================================
-   ===========================================================================
-   =========================================================================== */
+    LOG_DEBUG(F("CMD = 0x")); LOG_DEBUGHEX(&cmdByte2, 1);
 
-void dumpByteArray(byte* databuffer, int datalength) {
-    for (int i=0; i < datalength; i++) {
-        DEBUGOUT.print(byteToHexString(databuffer[i]));          
+    // Decode all known fields of this command from the registry and hand
+    // them to the publish scheduler
+    uint8_t known = 0;
+    CAField field;
+    for (uint8_t i = caFindCommand(cmdByte2); i < CAFIELD_COUNT; i++) {
+        caReadField(i, field);
+        if (field.command != cmdByte2) break;
+        if (field.offset + field.width > frame.dataLength()) continue;
+        publishSample(unit, i, caFieldValue(field, data));
+        known++;
     }
-    DEBUGOUT.println();
-}
 
-String byteToHexString(char c) {
-    char result[3];
-    result[0] = ((c & 0xF0) >> 4) + 0x30;
-    if (result[0] > 0x39) result[0] +=0x07;
-    result[1] = (c & 0x0F) + 0x30;
-    if (result[1] > 0x39) result[1] +=0x07;
-    result[2] = 0x00;
-    return String(result);
+    if (known == 0) {
+        LOG_DEBUGLN(F(" - Not parsed"));
+        return false;
+    }
+    LOG_DEBUG(F(" - Fields: ")); LOG_DEBUGLN(known);
+    return true;
 }
-
@@ -13,7 +13,17 @@
    -------------------------------------------------------------------------- */
 
 //SoftwareSerial zehnderPort(10, 11); // RX, TX
-#define ZEHNDER_PORT Serial1
+#define ZEHNDER_PORT Serial1                    // Captured through our own ISR, see uart.h
+
+// Several units can be connected to one board: unit 0 on Serial1, unit 1 on
+// Serial2 and unit 2 on Serial3. Each unit has its own receive ring,
+// decoder, polling plan, control queue and MQTT topics (see mqtt.h).
+#ifndef ZEHNDER_UNITS
+#define ZEHNDER_UNITS 1                         // Number of units, 1..3 (or build with -D ZEHNDER_UNITS=n)
+#endif
+#if (ZEHNDER_UNITS < 1) || (ZEHNDER_UNITS > 3)
+#error "ZEHNDER_UNITS must be 1, 2 or 3"
+#endif
 #define ZEHNDER_BAUDRATE 9600
 #define ZEHNDER_SERIALSETTINGS SERIAL_8N1
 
@@ -24,15 +34,13 @@
 // Start and stop of command
 const byte cacmd_StartCMD[] = { 0x07, 0xF0 };
 const byte cacmd_StopCMD[] = { 0x07, 0x0F };
+const byte cacmd_AckCMD[] = { 0x07, 0xF3 };     // Acknowledge, sent after every received frame
+
+class ComfoAirDecoder;
 
 // Function declarations
 void zehnderInit();
 void checkCommand();
-bool processCommand();
-float getTemperature(byte zehnderTemp);
-int checkBuffers(byte* newdata, int newdatasize, int offset);
-int findSequence(byte* dataarray, int datalength, int pos, const byte* sequence, int sequencelength);
-void dumpByteArray(byte* databuffer, int datalength);
-String byteToHexString(char c);
+bool processCommand(uint8_t unit, const ComfoAirDecoder& frame);
 
 #endif